@@ -0,0 +1,265 @@
+#include "allocator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/** How a mapped block is backed */
+enum class grid_pages {
+    explicit_huge,
+    transparent_huge,
+    regular
+};
+
+/** Mapped block */
+struct grid_mapping {
+    std::size_t length;
+    grid_pages pages;
+};
+
+/** Guards mappings and heap_bytes */
+static std::mutex grid_lock;
+
+/** Blocks currently mapped, by address */
+static std::map<std::uintptr_t, grid_mapping> mappings;
+
+/** Bytes of the small blocks currently allocated on the heap */
+static std::size_t heap_bytes{0};
+
+/**
+ * Length of the mapping of a large block
+ * @param bytes Size of the block
+ * @return Size rounded up to whole huge pages
+ */
+static std::size_t mappingLength(const std::size_t &bytes) {
+    return (bytes + grid_mapping_threshold - 1) / grid_mapping_threshold * grid_mapping_threshold;
+}
+
+/**
+ * Maps a block with regular pages, aligned to the huge page size so the kernel can back it with transparent huge
+ * pages later on
+ * @param length Size of the block, a multiple of the huge page size
+ * @return Block or MAP_FAILED
+ */
+static void *mapAligned(const std::size_t &length) {
+    void *mapping{mmap(nullptr, length + grid_mapping_threshold, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0)};
+    if (mapping == MAP_FAILED) { return MAP_FAILED; }
+
+    // Cut off the unaligned head and the rest of the tail
+    const auto address{reinterpret_cast<std::uintptr_t>(mapping)};
+    const std::uintptr_t aligned{(address + grid_mapping_threshold - 1) / grid_mapping_threshold *
+                                 grid_mapping_threshold};
+    if (aligned > address) { munmap(mapping, aligned - address); }
+    if (address + grid_mapping_threshold > aligned) {
+        munmap(reinterpret_cast<void *>(aligned + length), address + grid_mapping_threshold - aligned);
+    }
+    return reinterpret_cast<void *>(aligned);
+}
+
+#ifdef SWE_COUNT_ALLOCATIONS
+/** Heap allocations and mappings of the calling thread so far */
+static thread_local std::size_t thread_allocations{0};
+
+// Replaces the global allocation functions, the array and nothrow forms call these
+void *operator new(std::size_t bytes) {
+    ++thread_allocations;
+    if (void *block{std::malloc(bytes == 0 ? 1 : bytes)}) { return block; }
+    throw std::bad_alloc{};
+}
+
+void *operator new(std::size_t bytes, std::align_val_t alignment) {
+    ++thread_allocations;
+    void *block{nullptr};
+    if (posix_memalign(&block, std::max(static_cast<std::size_t>(alignment), sizeof(void *)),
+                       bytes == 0 ? 1 : bytes) == 0) {
+        return block;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *block) noexcept { std::free(block); }
+
+void operator delete(void *block, std::size_t /*bytes*/) noexcept { std::free(block); }
+
+void operator delete(void *block, std::align_val_t /*alignment*/) noexcept { std::free(block); }
+
+void operator delete(void *block, std::size_t /*bytes*/, std::align_val_t /*alignment*/) noexcept { std::free(block); }
+#endif
+
+std::size_t heap_allocations() noexcept {
+#ifdef SWE_COUNT_ALLOCATIONS
+    return thread_allocations;
+#else
+    return 0;
+#endif
+}
+
+void *allocate_grid(const std::size_t &bytes) {
+    if (bytes < grid_mapping_threshold) {
+        void *block{::operator new(bytes, std::align_val_t{grid_alignment})};
+        const std::lock_guard<std::mutex> guard{grid_lock};
+        heap_bytes += bytes;
+        return block;
+    }
+
+#ifdef SWE_COUNT_ALLOCATIONS
+    ++thread_allocations;
+#endif
+    const std::size_t length{mappingLength(bytes)};
+    grid_pages pages{grid_pages::explicit_huge};
+
+    // Explicit huge pages only work if enough of them are reserved, and fail right here otherwise
+    void *block{MAP_FAILED};
+#ifdef MAP_HUGETLB
+    block = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (block == MAP_FAILED) {
+        block = mapAligned(length);
+        if (block == MAP_FAILED) { throw std::bad_alloc{}; }
+        pages = grid_pages::regular;
+#ifdef MADV_HUGEPAGE
+        if (madvise(block, length, MADV_HUGEPAGE) == 0) { pages = grid_pages::transparent_huge; }
+#endif
+    }
+
+    const std::lock_guard<std::mutex> guard{grid_lock};
+    mappings[reinterpret_cast<std::uintptr_t>(block)] = {length, pages};
+    return block;
+}
+
+void free_grid(void *block, const std::size_t &bytes) noexcept {
+    if (block == nullptr) { return; }
+    if (bytes < grid_mapping_threshold) {
+        ::operator delete(block, std::align_val_t{grid_alignment});
+        const std::lock_guard<std::mutex> guard{grid_lock};
+        heap_bytes -= bytes;
+        return;
+    }
+
+    munmap(block, mappingLength(bytes));
+    const std::lock_guard<std::mutex> guard{grid_lock};
+    mappings.erase(reinterpret_cast<std::uintptr_t>(block));
+}
+
+/**
+ * Reads a size in kB from a file like /proc/meminfo
+ * @param file File to search
+ * @param key Name of the line, including the colon
+ * @return Size in bytes of the first line with that name, 0 if there is none
+ */
+static std::size_t readKilobytes(std::istream &file, const std::string &key) {
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return std::stoull(line.substr(key.size())) * 1024;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Counts the transparent huge pages the kernel backed the given blocks with so far
+ * @param blocks Start and end address of each block
+ * @return Bytes on transparent huge pages
+ */
+static std::size_t transparentHugeBytes(const std::map<std::uintptr_t, std::uintptr_t> &blocks) {
+    std::ifstream smaps{"/proc/self/smaps"};
+    std::size_t bytes{0};
+    bool overlaps{false};
+    std::string line;
+    while (std::getline(smaps, line)) {
+        // Each mapping starts with a line "start-end perms ...", followed by lines "Key: value"
+        const std::size_t dash{line.find('-')};
+        const std::size_t space{line.find(' ')};
+        if (dash != std::string::npos && dash < space) {
+            const std::uintptr_t start{std::stoull(line.substr(0, dash), nullptr, 16)};
+            const std::uintptr_t end{std::stoull(line.substr(dash + 1, space - dash - 1), nullptr, 16)};
+            auto block{blocks.upper_bound(start)};
+            overlaps = (block != blocks.end() && block->first < end) ||
+                       (block != blocks.begin() && std::prev(block)->second > start);
+        } else if (overlaps && line.compare(0, 14, "AnonHugePages:") == 0) {
+            bytes += std::stoull(line.substr(14)) * 1024;
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Formats a size for the run log
+ * @param bytes Size
+ * @return Size in MiB, or in kB for page sizes below 1 MiB
+ */
+static std::string formatBytes(const std::size_t &bytes) {
+    std::ostringstream out;
+    if (bytes < (std::size_t{1} << 20U)) {
+        out << bytes / 1024 << " kB";
+    } else {
+        out << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / (1U << 20U) << " MiB";
+    }
+    return out.str();
+}
+
+std::string describe_grid_pages() {
+    std::size_t explicit_bytes{0};
+    std::size_t regular_bytes{0};
+    std::size_t small_bytes{0};
+    std::map<std::uintptr_t, std::uintptr_t> advised;
+    {
+        const std::lock_guard<std::mutex> guard{grid_lock};
+        for (const auto &[address, mapping] : mappings) {
+            if (mapping.pages == grid_pages::explicit_huge) {
+                explicit_bytes += mapping.length;
+            } else {
+                regular_bytes += mapping.length;
+                if (mapping.pages == grid_pages::transparent_huge) { advised[address] = address + mapping.length; }
+            }
+        }
+        small_bytes = heap_bytes;
+    }
+
+    std::ostringstream out;
+    out << "Grid memory:";
+    if (explicit_bytes > 0) {
+        std::ifstream meminfo{"/proc/meminfo"};
+        out << ' ' << formatBytes(explicit_bytes) << " on " << formatBytes(readKilobytes(meminfo, "Hugepagesize:"))
+            << " pages,";
+    }
+    if (regular_bytes > 0) {
+        const std::size_t transparent_bytes{advised.empty() ? 0 : transparentHugeBytes(advised)};
+        out << ' ' << formatBytes(regular_bytes - std::min(transparent_bytes, regular_bytes)) << " on "
+            << formatBytes(static_cast<std::size_t>(sysconf(_SC_PAGESIZE))) << " pages, "
+            << formatBytes(transparent_bytes) << " on transparent huge pages,";
+    }
+    out << ' ' << formatBytes(small_bytes) << " on the heap";
+    return out.str();
+}
+
+std::string describe_memory_usage() {
+    // Both lines are in kB, VmRSS follows VmHWM ("high water mark")
+    std::ifstream status{"/proc/self/status"};
+    const std::size_t peak_bytes{readKilobytes(status, "VmHWM:")};
+    const std::size_t resident_bytes{readKilobytes(status, "VmRSS:")};
+
+    std::ostringstream out;
+    out << "Process memory: " << formatBytes(resident_bytes) << " resident, " << formatBytes(peak_bytes) << " at peak";
+    return out.str();
+}
+
+void release_free_memory() noexcept {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
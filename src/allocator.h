@@ -0,0 +1,95 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Alignment of every grid block in bytes. One cache line and one AVX-512 register. */
+static constexpr std::size_t grid_alignment{64};
+
+/** Blocks of at least this many bytes are mapped on their own, so they can be backed by huge pages */
+static constexpr std::size_t grid_mapping_threshold{std::size_t{2} << 20U};
+
+/**
+ * Counts the allocations of the calling thread, to check that timesteps don't allocate. Counts calls of the global
+ * operator new, which this file replaces, and blocks of allocate_grid. Only builds with SWE_COUNT_ALLOCATIONS count.
+ * @return Number of allocations of the calling thread so far, always 0 if they are not counted
+ */
+std::size_t heap_allocations() noexcept;
+
+/**
+ * Allocates a block for grids. Large blocks get explicit huge pages if the system has enough of them reserved, or
+ * else transparent huge pages if the kernel allows them, or else regular pages. Small blocks come from the heap.
+ * @param bytes Size of the block
+ * @return Block aligned to at least grid_alignment, with uninitialized contents
+ */
+void* allocate_grid(const std::size_t& bytes);
+
+/**
+ * Frees a block of allocate_grid
+ * @param block Block to free
+ * @param bytes Size the block was allocated with
+ */
+void free_grid(void* block, const std::size_t& bytes) noexcept;
+
+/**
+ * Describes the pages backing all grid blocks currently allocated. Transparent huge pages are only counted once the
+ * kernel actually backed the memory with them.
+ * @return One line for the run log
+ */
+std::string describe_grid_pages();
+
+/**
+ * Describes the memory of the whole process. Logged once the simulation is set up, it shows whether the source data
+ * of the scenario was released.
+ * @return One line for the run log with the current and the peak resident set size
+ */
+std::string describe_memory_usage();
+
+/** Gives memory freed on the heap back to the system, e.g. after the source data of a scenario was released */
+void release_free_memory() noexcept;
+
+/**
+ * Allocator for containers of grid values, see allocate_grid. Values constructed without arguments stay
+ * uninitialized, so no page is touched before the cells are filled. The thread writing a page first decides on which
+ * NUMA node it lives.
+ * @tparam value Type of the values
+ */
+template <typename value>
+struct grid_allocator {
+  using value_type = value;
+
+  grid_allocator() = default;
+
+  template <typename other>
+  grid_allocator(const grid_allocator<other>& /*allocator*/) noexcept {}
+
+  value* allocate(const std::size_t& size) { return static_cast<value*>(allocate_grid(size * sizeof(value))); }
+
+  void deallocate(value* values, const std::size_t& size) noexcept { free_grid(values, size * sizeof(value)); }
+
+  template <typename other>
+  void construct(other* element) noexcept(std::is_nothrow_default_constructible_v<other>) {
+    ::new (static_cast<void*>(element)) other;
+  }
+
+  template <typename other, typename... arguments>
+  void construct(other* element, arguments&&... args) {
+    ::new (static_cast<void*>(element)) other(std::forward<arguments>(args)...);
+  }
+
+  template <typename other>
+  bool operator==(const grid_allocator<other>& /*allocator*/) const noexcept { return true; }
+
+  template <typename other>
+  bool operator!=(const grid_allocator<other>& /*allocator*/) const noexcept { return false; }
+};
+
+/** Vector of grid values */
+template <typename value>
+using grid_vector = std::vector<value, grid_allocator<value>>;
+
+#endif  // ALLOCATOR_H
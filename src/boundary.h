@@ -0,0 +1,32 @@
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+/**
+ * Boundary conditions at the borders of the grid. The sweep kernels are templates on one of these, so the condition
+ * is chosen once when a simulation is created and not checked inside the kernels. A boundary type describes the ghost
+ * cell outside of a border cell, which has the height of the border cell.
+ */
+
+/** Water leaves the grid freely */
+struct outflow_boundary {
+  /**
+   * Momentum normal to the border in the ghost cell
+   * @param momentum Momentum normal to the border in the border cell
+   * @return Same momentum
+   */
+  template <typename real>
+  static constexpr real ghost_momentum(const real& momentum) { return momentum; }
+};
+
+/** Water is reflected by walls */
+struct wall_boundary {
+  /**
+   * Momentum normal to the border in the ghost cell
+   * @param momentum Momentum normal to the border in the border cell
+   * @return Reversed momentum
+   */
+  template <typename real>
+  static constexpr real ghost_momentum(const real& momentum) { return -momentum; }
+};
+
+#endif  // BOUNDARY_H
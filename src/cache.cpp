@@ -0,0 +1,124 @@
+#include "cache.h"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+/** 64 bit FNV prime */
+static constexpr std::uint64_t hash_prime{1099511628211ULL};
+
+std::uint64_t hash_bytes(std::uint64_t hash, const void *data, const std::size_t &size) {
+    const auto *bytes{static_cast<const unsigned char *>(data)};
+    std::size_t i{0};
+    for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+        std::uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * hash_prime;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * hash_prime;
+    }
+    return hash;
+}
+
+std::optional<std::uint64_t> file_key(const std::string &name) {
+    struct stat status{};
+    if (stat(name.c_str(), &status) != 0) { return std::nullopt; }
+    const std::array<std::int64_t, 3> meta{status.st_size, status.st_mtim.tv_sec, status.st_mtim.tv_nsec};
+    std::uint64_t key{hash_bytes(hash_basis, meta.data(), sizeof(meta))};
+
+    std::ifstream file{name, std::ios::binary};
+    std::vector<char> buffer(std::size_t{1} << 20U);
+    file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    key = hash_bytes(key, buffer.data(), static_cast<std::size_t>(file.gcount()));
+    if (static_cast<std::size_t>(status.st_size) > buffer.size()) {
+        file.clear();
+        file.seekg(-static_cast<std::streamoff>(buffer.size()), std::ios::end);
+        file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        key = hash_bytes(key, buffer.data(), static_cast<std::size_t>(file.gcount()));
+    }
+    if (file.bad()) { return std::nullopt; }
+    return key;
+}
+
+/**
+ * Directory of the cache files
+ * @return SWE_CACHE_DIR, XDG_CACHE_HOME/swe, ~/.cache/swe or a directory in the temporary directory, whichever is set
+ */
+static std::filesystem::path cacheDirectory() {
+    if (const char *directory{std::getenv("SWE_CACHE_DIR")}) { return directory; }
+    if (const char *xdg{std::getenv("XDG_CACHE_HOME")}) { return std::filesystem::path{xdg} / "swe"; }
+    if (const char *home{std::getenv("HOME")}) { return std::filesystem::path{home} / ".cache" / "swe"; }
+    return std::filesystem::temp_directory_path() / "swe";
+}
+
+std::string cache_path(const std::uint64_t &key, const std::string &extension) {
+    std::error_code error;
+    const std::filesystem::path directory{cacheDirectory()};
+    std::filesystem::create_directories(directory, error);
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << '.' << extension;
+    return (directory / name.str()).string();
+}
+
+bool write_cache_file(const std::string &path, const std::function<void(std::ofstream &)> &write) {
+    const std::string temporary{path + "." + std::to_string(getpid()) + ".tmp"};
+    {
+        std::ofstream file{temporary, std::ios::binary};
+        write(file);
+        if (!file) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) { std::remove(temporary.c_str()); }
+    return !error;
+}
+
+void pad_cache_file(std::ofstream &file) {
+    const auto position{static_cast<std::size_t>(file.tellp())};
+    const std::vector<char> padding((cache_alignment - position % cache_alignment) % cache_alignment, 0);
+    file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+}
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+        : mapping{std::exchange(other.mapping, nullptr)},
+          length{std::exchange(other.length, 0)} {}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept {
+    std::swap(mapping, other.mapping);
+    std::swap(length, other.length);
+    return *this;
+}
+
+mapped_file::~mapped_file() {
+    if (mapping != nullptr) { munmap(mapping, length); }
+}
+
+std::optional<mapped_file> mapped_file::open(const std::string &path, const std::size_t &min_length) {
+    const int file{::open(path.c_str(), O_RDONLY)};
+    if (file < 0) { return std::nullopt; }
+    struct stat status{};
+    const bool sized{fstat(file, &status) == 0 && static_cast<std::size_t>(status.st_size) >= min_length &&
+                     status.st_size > 0};
+    void *mapped{sized ? mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED};
+    close(file);
+    if (mapped == MAP_FAILED) { return std::nullopt; }
+
+    mapped_file result;
+    result.mapping = mapped;
+    result.length = static_cast<std::size_t>(status.st_size);
+    return result;
+}
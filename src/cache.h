@@ -0,0 +1,98 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+
+/** Hash of no bytes, the start of every hash_bytes chain */
+static constexpr std::uint64_t hash_basis{14695981039346656037ULL};
+
+/** Data in cache files starts at a multiple of this many bytes, so it can be used right from the mapping */
+static constexpr std::size_t cache_alignment{64};
+
+/**
+ * Hashes bytes with FNV-1a over 64 bit words, followed by the remaining bytes. Fast enough to check whole grids.
+ * @param hash Hash of the bytes before, hash_basis to start
+ * @param data Bytes to add
+ * @param size Number of bytes
+ * @return Hash including the bytes
+ */
+std::uint64_t hash_bytes(std::uint64_t hash, const void* data, const std::size_t& size);
+
+/**
+ * Key of an input file, cheap enough to compute on every run. Hashes the size, the modification time and the first
+ * and last MiB of the file, which cover the NetCDF header and the end of the data. This is not a hash of the contents:
+ * a file rewritten in place with the same size and modification time and changes only in the middle of its data keeps
+ * its key. Cache files therefore also check the grids in the NetCDF headers of the files they were made from.
+ * @param name Name of the file
+ * @return Key, or nothing if the file can't be read
+ */
+std::optional<std::uint64_t> file_key(const std::string& name);
+
+/**
+ * Path of a cache file, creating its directory if needed. Cache files live in SWE_CACHE_DIR, XDG_CACHE_HOME/swe,
+ * ~/.cache/swe or a directory in the temporary directory, whichever is set first.
+ * @param key Key of the cached data
+ * @param extension Kind of the cached data
+ * @return Path of the cache file
+ */
+std::string cache_path(const std::uint64_t& key, const std::string& extension);
+
+/**
+ * Writes a cache file. Writes a temporary file first and renames it, so other runs never map half a file.
+ * @param path Cache file
+ * @param write Writes the contents
+ * @return Whether the file could be written
+ */
+bool write_cache_file(const std::string& path, const std::function<void(std::ofstream&)>& write);
+
+/**
+ * Pads a cache file being written up to the next multiple of cache_alignment
+ * @param file File being written
+ */
+void pad_cache_file(std::ofstream& file);
+
+/** Cache file mapped read-only into memory */
+class mapped_file {
+private:
+  /** Start of the mapping */
+  void* mapping{nullptr};
+
+  /** Size of the mapping in bytes */
+  std::size_t length{0};
+
+  mapped_file() = default;
+
+public:
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+  mapped_file(mapped_file&& other) noexcept;
+  mapped_file& operator=(mapped_file&& other) noexcept;
+  ~mapped_file();
+
+  /**
+   * Maps a file
+   * @param path File to map
+   * @param min_length Files shorter than this many bytes are not mapped, e.g. the size of their header
+   * @return Mapping, or nothing if the file is missing or too short
+   */
+  static std::optional<mapped_file> open(const std::string& path, const std::size_t& min_length);
+
+  /**
+   * Getter for the contents
+   * @return Start of the mapping
+   */
+  [[nodiscard]] const char* data() const { return static_cast<const char*>(mapping); }
+
+  /**
+   * Getter for the size
+   * @return Size of the mapping in bytes
+   */
+  [[nodiscard]] std::size_t size() const { return length; }
+};
+
+#endif  // CACHE_H
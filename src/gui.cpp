@@ -2,6 +2,8 @@
 #include "simulation.h"
 
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <string>
 #include <gtkmm/cssprovider.h>
 #include <array>
@@ -52,6 +54,10 @@ Gui::Gui(BaseObjectType *cobject, const Glib::RefPtr<Gtk::Builder> &refBuilder)
     check_widget("page_1_revealer_result_output", page_1_revealer_result_output);               // get page 1 revealer for
     check_widget("page_1_file_chooser_bathymetry", page_1_file_chooser_bathymetry);             // get page 1 bathymetry filechooser
     check_widget("page_1_file_chooser_displacement", page_1_file_chooser_displacement);         // get page 1 displacement filechooser
+    check_widget("page_1_spin_button_region_x", page_1_spin_button_region_x);                   // get page 1 region of interest x
+    check_widget("page_1_spin_button_region_y", page_1_spin_button_region_y);                   // get page 1 region of interest y
+    check_widget("page_1_spin_button_region_width", page_1_spin_button_region_width);           // get page 1 region of interest width
+    check_widget("page_1_spin_button_region_height", page_1_spin_button_region_height);         // get page 1 region of interest height
     check_widget("page_1_file_chooser_output_directory", page_1_file_chooser_output_directory); // get page 1 output directory filechooser
     check_widget("page_1_entry_output_file_name", page_1_entry_output_file_name);               // get page 1 output file name
     check_widget("page_1_label_error", page_1_label_error);                                     // get page 1 error label
@@ -110,6 +116,7 @@ Gui::Gui(BaseObjectType *cobject, const Glib::RefPtr<Gtk::Builder> &refBuilder)
     dispatcher_progressbar_update.connect(sigc::mem_fun(*this, &Gui::on_notification_from_animation_worker_thread));                // connect progressbar animation dispatcher
     dispatcher_show_result_page.connect(sigc::mem_fun(*this, &Gui::on_notification_to_change_to_result_page));                      // connect change to result page dispatcher
     dispatcher_set_result_duration.connect(sigc::mem_fun(*this, &Gui::on_notification_to_set_result_duration));                     // connect set result duration dispatcher
+    dispatcher_show_error_page.connect(sigc::mem_fun(*this, &Gui::on_notification_to_show_error_page));                             // connect show error page dispatcher
 
     // show the gui
     show_all();
@@ -126,67 +133,11 @@ Gui::Gui(BaseObjectType *cobject, const Glib::RefPtr<Gtk::Builder> &refBuilder)
 
 /**
  * Destructor of the GUI class
- * Deletes all pointers to the UI elements
+ * Stops a running simulation before the widgets it reports to are gone. The child widgets belong to the builder and
+ * this window to main(), so nothing is deleted here.
  */
 Gui::~Gui () {
-
-    // page 0
-    delete page_0_button_load_checkpoint;
-    delete page_0_button_start_new;
-    delete page_0_button_how_to;
-    delete page_0_button_about;
-    delete page_0_button_quit;
-
-    // page 1
-    delete page_1_spin_button_x_dim;
-    delete page_1_spin_button_y_dim;
-    delete page_1_spin_button_sim_time;
-    delete page_1_spin_button_num_time_steps;
-    delete page_1_spin_button_num_threads;
-    delete page_1_combobox_output;
-    delete page_1_spin_button_coarseness_factor;
-    delete page_1_combobox_boundary;
-    delete page_1_combobox_scenario;
-    delete page_1_revealer_scenario_input;
-    delete page_1_revealer_result_output;
-    delete page_1_file_chooser_bathymetry;
-    delete page_1_file_chooser_displacement;
-    delete page_1_file_chooser_output_directory;
-    delete page_1_entry_output_file_name;
-    delete page_1_label_error;
-    delete page_1_button_submit;
-    delete page_1_button_back;
-
-    // page 2
-    delete page_2_button_submit;
-    delete page_2_file_chooser_load_checkpoint;
-    delete page_2_label_error;
-    delete page_2_button_back;
-    delete page_2_file_chooser_load_output_file;
-    delete page_2_spin_button_num_threads;
-
-    // page 3
-    delete page_3_progress_bar_progress;
-    delete page_3_button_cancel;
-    delete page_3_label_time_remaining_dynamic;
-
-    // page 4
-    delete page_4_label_output_path;
-    delete page_4_label_time_spent_dynamic;
-    delete page_4_button_open_file_location;
-    delete page_4_button_quit;
-    delete page_4_button_set_up_new;
-    delete page_4_label_paraview_error;
-    delete page_4_button_paraview;
-
-    // page 5
-    delete page_5_label_error_message;
-    delete page_5_button_return_main_menu;
-    delete page_5_button_quit;
-
-    // top level widgets
-    delete gui_stack;
-    delete main_window;
+    simulation_thread.stop();
 }
 
 /**
@@ -212,6 +163,10 @@ void Gui::on_return_to_main_menu() {
     page_1_spin_button_coarseness_factor->set_value(1);
     page_1_file_chooser_bathymetry->unselect_all();
     page_1_file_chooser_displacement->unselect_all();
+    page_1_spin_button_region_x->set_value(0);
+    page_1_spin_button_region_y->set_value(0);
+    page_1_spin_button_region_width->set_value(0);
+    page_1_spin_button_region_height->set_value(0);
     page_1_file_chooser_output_directory->unselect_all();
     page_1_entry_output_file_name->set_text("");
 
@@ -318,23 +273,6 @@ void Gui::on_page_1_submit_button_clicked() {
         return;
     }
 
-
-
-    // check bathymetry file
-    if (scenario_id == 0 && !verify_input(page_1_file_chooser_bathymetry->get_filename())) {
-        // Display error message that the bathymetry file is not valid
-        page_1_label_error->set_text("<span color=\"red\">Bathymetry file is not valid!</span>");
-        page_1_label_error->set_use_markup(true);
-        page_1_label_error->set_visible(true);
-        return;
-    } else if (scenario_id == 0 && !verify_input(page_1_file_chooser_displacement->get_filename())) {
-        // Display error message that the displacement file is not valid
-        page_1_label_error->set_text("<span color=\"red\">Displacement file is not valid!</span>");
-        page_1_label_error->set_use_markup(true);
-        page_1_label_error->set_visible(true);
-        return;
-    }
-
     // check for valid output settings
     if (generate_output &&
             (page_1_file_chooser_output_directory->get_filename().empty() ||
@@ -347,26 +285,35 @@ void Gui::on_page_1_submit_button_clicked() {
     }
 
 
-    // construct scenario
+    // region of interest, only files are loaded partially
+    region roi {};
     if (scenario_id == 0) {
-        // from file
-        scen = new file_scenario {file_scenario::create(page_1_file_chooser_bathymetry->get_filename(),
-                                                            page_1_file_chooser_displacement->get_filename())};
-    } else if (scenario_id == 1) {
-        // radial dam break
-        scen = new radial_dambreak_obstacle_scenario {};
-    } else {
-        // artificial scenario
-        scen = new artificial_tsunami_scenario {};
+        roi = {{static_cast<float>(page_1_spin_button_region_x->get_value()),
+                static_cast<float>(page_1_spin_button_region_y->get_value())},
+               {static_cast<float>(page_1_spin_button_region_width->get_value()),
+                static_cast<float>(page_1_spin_button_region_height->get_value())}};
     }
 
+    // a previous simulation that was canceled may still be finishing its timestep
+    simulation_thread.stop();
+
+    // lets the cancel button stop the simulation
+    cancel_token cancel;
 
     // construct sim_options
     sim_options sim_opt {std::array<std::size_t, 2>{static_cast<unsigned long>(page_1_spin_button_x_dim->get_value()),
                                                     static_cast<unsigned long>(page_1_spin_button_y_dim->get_value())},
                          uses_walls,
                          static_cast<float>(page_1_spin_button_sim_time->get_value()),
-                         static_cast<int>(page_1_spin_button_num_threads->get_value())};
+                         static_cast<int>(page_1_spin_button_num_threads->get_value()),
+                         sweep_kernel::tiled,
+                         {0, 0},
+                         0,
+                         false,
+                         instruction_set::automatic,
+                         false,
+                         roi,
+                         cancel};
 
     // construct output options
     output_options out_opt {generate_output,
@@ -376,9 +323,6 @@ void Gui::on_page_1_submit_button_clicked() {
                             static_cast<float>(page_1_spin_button_coarseness_factor->get_value()),
                             *this};
 
-    // construct simulation
-    simulation sim {simulation::create(*scen, sim_opt)};
-
     // set the output directory
     directory = page_1_file_chooser_output_directory->get_filename();
     // set filename
@@ -387,15 +331,76 @@ void Gui::on_page_1_submit_button_clicked() {
     // display progress page
     gui_stack->set_visible_child("page_progress");
 
+    // input files are loaded by the simulation thread, which reports the load progress
+    {
+        std::lock_guard<std::mutex> lock(progress_bat_mtx);
+        load_fraction = 0;
+    }
+
     // call page 3 handler
     Gui::page_3_handler();
 
     // set time for start
     time(&time_start);
 
-    // start simulation in separate thread
-    std::thread simulation_thread (&simulation::run, sim, out_opt);
-    simulation_thread.detach();
+    // load scenario, then create and run simulation in separate thread, so the ui stays responsive
+    const std::string bathy_name {page_1_file_chooser_bathymetry->get_filename()};
+    const std::string displ_name {page_1_file_chooser_displacement->get_filename()};
+    simulation_thread = simulation_worker {cancel, [this, id = scenario_id, bathy_name, displ_name, roi, sim_opt, out_opt]() {
+        try {
+            // the scenario is only needed to sample the initial state, its data is released before the simulation runs
+            simulation sim {[&]() {
+                std::unique_ptr<scenario> scen;
+                if (id == 0) {
+                    // from file, or from the state an earlier run with the same files and grid sampled from them
+                    std::optional<cached_scenario> cached {cached_scenario::open(bathy_name, displ_name, roi,
+                                                                                 sim_opt.num_cells)};
+                    if (!cached) {
+                        // the cancel button stops reading at the next block of rows
+                        std::unique_ptr<file_scenario> loaded {new file_scenario {file_scenario::create(
+                                bathy_name, displ_name, roi, sim_opt.num_cells, [this, &sim_opt](const float &fraction) {
+                                    sim_opt.cancel.throw_if_canceled();
+                                    update_load_progress(fraction);
+                                })}};
+                        sim_opt.cancel.throw_if_canceled();
+                        cached = cached_scenario::store(*loaded, bathy_name, displ_name, roi, sim_opt.num_cells);
+                        if (!cached) {
+                            scen = std::move(loaded);
+                        }
+                    }
+                    if (cached) {
+                        scen = std::make_unique<cached_scenario>(std::move(*cached));
+                    }
+                } else if (id == 1) {
+                    // radial dam break
+                    scen = std::make_unique<radial_dambreak_obstacle_scenario>();
+                } else {
+                    // artificial scenario
+                    scen = std::make_unique<artificial_tsunami_scenario>();
+                }
+
+                // construct simulation
+                sim_opt.cancel.throw_if_canceled();
+                return simulation::create(*scen, sim_opt);
+            }()};
+            release_free_memory();
+
+            {
+                std::lock_guard<std::mutex> lock(progress_bat_mtx);
+                load_fraction = -1;
+            }
+
+            // the simulation lives on this thread's stack, the cancel button reaches it through the token
+            if (sim_opt.cancel.is_canceled()) {
+                return;
+            }
+            sim.run(out_opt);
+        } catch (const canceled_error &) {
+            // the cancel button already returned to the main menu
+        } catch (const std::exception &error) {
+            show_error_page(error.what());
+        }
+    }};
 }
 
 /**
@@ -484,7 +489,10 @@ void Gui::page_3_handler() {
  * Called when the user chooses to cancel the simulation
  */
 void Gui::on_page_3_button_cancel_clicked() {
-    //scen.stop()
+    // stops the simulation after its current timestep, the thread is joined before the next simulation starts
+    simulation_thread.cancel();
+    // stop the progress bar animation without showing the result page
+    update_progress(0.F, -2);
     on_return_to_main_menu();
 }
 
@@ -499,6 +507,7 @@ void Gui::page_3_animation_worker() {
     int minutes = 0;
     int seconds = 0;
     bool finish = false;
+    bool loading = false;
 
     //page_3_progress_bar_progress->set_fraction(0);
     //while(Gtk::Main::events_pending()) Gtk::Main::iteration(false);
@@ -511,6 +520,15 @@ void Gui::page_3_animation_worker() {
             std::lock_guard<std::mutex> lock(progress_bat_mtx);
             worker_target_fraction = simulation_fraction;
             worker_time_remaining = simulation_time_remaining;
+            if (load_fraction >= 0 && worker_time_remaining != -2) {
+                worker_target_fraction = load_fraction;
+                worker_time_remaining = 0;
+                loading = true;
+            } else if (loading) {
+                // input files are loaded, the bar starts over for the simulation
+                worker_actual_fraction = 0;
+                loading = false;
+            }
         }
 
         // sleep 1 frame
@@ -556,7 +574,10 @@ void Gui::page_3_animation_worker() {
             // set new progress
             worker_actual_fraction += progress_step;
 
-            if (frames_passed == 0) {
+            if (loading) {
+                // show load progress instead of the time remaining
+                worker_message = "Loading input files: " + std::to_string(static_cast<int>(worker_target_fraction * 100)) + " %";
+            } else if (frames_passed == 0) {
                 // update time remaining message every second
                 minutes = worker_time_remaining / 60;
                 seconds = worker_time_remaining % 60;
@@ -625,8 +646,6 @@ void Gui::notify_progress_bar_update() {
  */
 void Gui::on_notification_to_change_to_result_page() {
     gui_stack->set_visible_child("page_result");
-    delete scen;
-    scen = nullptr;
 }
 
 /**
@@ -699,6 +718,18 @@ void Gui::update_progress(float _progress, int _time_remaining) {
     }
 }
 
+/**
+ * Called by swe backend while loading the input files. Thread safe.
+ * @param _progress Fraction of the input files already loaded
+ */
+void Gui::update_load_progress(float _progress) {
+    std::lock_guard<std::mutex> lock(progress_bat_mtx);
+    // loading may already be over if the last report comes late
+    if (this->load_fraction >= 0) {
+        this->load_fraction = _progress;
+    }
+}
+
 void Gui::on_notification_to_set_result_duration() {
     {
         std::lock_guard<std::mutex> lock(result_duration_mtx);
@@ -709,12 +740,28 @@ void Gui::on_notification_to_set_result_duration() {
 
 
 /**
- * Called by swe backend. Invoked to show the error page as soon as an error has occurred
+ * Called by swe backend. Invoked to show the error page as soon as an error has occurred. Thread safe.
  * @param error Contains the error message
  */
 void Gui::show_error_page(std::string error) {
     // set time remaining to 0
     update_progress(1.0F, -2);
-    page_5_label_error_message->set_text(error);
+    {
+        std::lock_guard<std::mutex> lock(error_message_mtx);
+        error_message = std::move(error);
+    }
+    // omit signal to show the error page from the main thread
+    dispatcher_show_error_page.emit();
+}
+
+/**
+ * Invoked after a signal from the dispatcher show error page was omitted.
+ * This method is connected to this signal.
+ */
+void Gui::on_notification_to_show_error_page() {
+    {
+        std::lock_guard<std::mutex> lock(error_message_mtx);
+        page_5_label_error_message->set_text(error_message);
+    }
     gui_stack->set_visible_child("page_error");
 }
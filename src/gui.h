@@ -23,6 +23,7 @@
 #include <unistd.h>
 
 #include "scenario.h"
+#include "worker.h"
 
 class scenario;
 
@@ -65,6 +66,7 @@ protected:
   Glib::Dispatcher dispatcher_progressbar_update;
   Glib::Dispatcher dispatcher_show_result_page;
   Glib::Dispatcher dispatcher_set_result_duration;
+  Glib::Dispatcher dispatcher_show_error_page;
 
   std::mutex progress_bat_mtx;
 
@@ -76,15 +78,22 @@ protected:
   double simulation_fraction;
   int simulation_time_remaining;
 
+  // fraction of the input files loaded, -1 once loading is done
+  double load_fraction = -1;
+
   double main_thread_fraction;
   std::string main_thread_message;
 
   std::mutex result_duration_mtx;
   std::string result_duration_string;
 
+  // message of the error page, set by the simulation thread
+  std::mutex error_message_mtx;
+  std::string error_message;
+
+  // thread loading and running the current simulation, stopped and joined before the next one or on shutdown
+  simulation_worker simulation_thread;
 
-  // scenario reference
-  scenario *scen;
 
   // ui
   Glib::RefPtr<Gtk::Builder> ui;
@@ -115,6 +124,10 @@ protected:
   Gtk::Revealer* page_1_revealer_result_output;
   Gtk::FileChooser* page_1_file_chooser_bathymetry;
   Gtk::FileChooser* page_1_file_chooser_displacement;
+  Gtk::SpinButton* page_1_spin_button_region_x;
+  Gtk::SpinButton* page_1_spin_button_region_y;
+  Gtk::SpinButton* page_1_spin_button_region_width;
+  Gtk::SpinButton* page_1_spin_button_region_height;
   Gtk::FileChooser* page_1_file_chooser_output_directory;
   Gtk::Entry* page_1_entry_output_file_name;
 
@@ -186,6 +199,7 @@ protected:
   void on_notification_from_animation_worker_thread();
   void on_notification_to_change_to_result_page();
   void on_notification_to_set_result_duration();
+  void on_notification_to_show_error_page();
 
 
 public:
@@ -195,6 +209,7 @@ public:
 
   // update function
   void update_progress(float progress, int time_remaining);    // page 3 progress bar
+  void update_load_progress(float progress);                   // page 3 progress bar while loading input files
   void show_error_page(std::string error);
   bool was_canceled();
   void notify_progress_bar_update();
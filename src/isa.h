@@ -0,0 +1,38 @@
+#ifndef ISA_H
+#define ISA_H
+
+/** Instruction sets the numerical kernels are compiled for, from least to most capable */
+enum class instruction_set {
+  /** Best one supported by the CPU, unless the environment variable SWE_ISA names one */
+  automatic,
+  /** Whatever the compiler targets by default */
+  generic,
+  /** SSE4.2, x86 only */
+  sse42,
+  /** AVX2, x86 only */
+  avx2,
+  /** AVX-512F with 512 bit vectors, x86 only */
+  avx512
+};
+
+/**
+ * Tag types of the instruction sets. The kernels are templates on one of these, so each variant compiled from
+ * kernels.cpp gets its own kernel symbols.
+ */
+struct isa_generic {};
+struct isa_sse42 {};
+struct isa_avx2 {};
+struct isa_avx512 {};
+
+/**
+ * Compiles a function for the instruction set of the kernel variant, if SWE_KERNEL_TARGET names one. Only the kernels
+ * and the solver functions with internal linkage carry it. Inline functions and templates used by several variants are
+ * merged by the linker, so they are compiled for the baseline everywhere instead of with -m flags for the whole file.
+ */
+#ifdef SWE_KERNEL_TARGET
+#define SWE_TARGET __attribute__((target(SWE_KERNEL_TARGET)))
+#else
+#define SWE_TARGET
+#endif
+
+#endif  // ISA_H
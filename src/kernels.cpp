@@ -0,0 +1,951 @@
+// Numerical kernels of the simulation. This file is compiled once per instruction set, with SWE_KERNEL_ISA naming the
+// tag type of that variant, see CMakeLists.txt. Every kernel is a template on the tag and compiled for its instruction
+// set with SWE_TARGET, so the simulation can pick a variant at runtime.
+#include "simulation.h"
+#include <limits>
+
+#ifndef SWE_KERNEL_ISA
+#define SWE_KERNEL_ISA isa_generic
+#endif
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET void basic_simulation<precision, layout>::selectKernels() {
+    update_ghost_rows = &basic_simulation::updateGhostRows<boundary, isa>;
+    switch (kernel) {
+        case sweep_kernel::split:
+            compute_sweeps = &basic_simulation::computeSweeps<boundary, isa>;
+            break;
+        case sweep_kernel::fused:
+            compute_sweeps = &basic_simulation::computeFusedSweeps<boundary, isa>;
+            break;
+        case sweep_kernel::tiled:
+            compute_sweeps = &basic_simulation::computeTiledSweeps<boundary, isa>;
+            break;
+        case sweep_kernel::temporal:
+            compute_sweeps = &basic_simulation::computeTemporalSweeps<boundary, isa>;
+            break;
+    }
+}
+
+template <typename precision, typename layout>
+template <typename heights>
+void basic_simulation<precision, layout>::recordFailure(const heights &values, const std::size_t &first_value,
+                                                        const std::size_t &first_cell, const std::size_t &count,
+                                                        const std::size_t &sweep) {
+    team_slot &slot{team_slots[static_cast<std::size_t>(omp_get_thread_num())]};
+    for (std::size_t i = 0; i < count && slot.failed_cell == no_cell; ++i) {
+        // Ghost rows only mirror the cells next to them. Also catches NaN.
+        const std::size_t cell{first_cell + i};
+        const bool ghost{cell < num_cells[0] || cell >= num_cells[0] * (num_cells[1] + 1)};
+        if (!ghost && b[cell] < 0.F && !(values[first_value + i] > 0.F)) {
+            slot.failed_cell = cell;
+            slot.failed_sweep = sweep;
+        }
+    }
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET void basic_simulation<precision, layout>::updateGhostRows() {
+    // Set up boundaries according to uses_walls
+#pragma omp for schedule(static) nowait
+    for (std::size_t x = 0; x < num_cells[0]; ++x) {
+        // Height
+        h[x] = h[num_cells[0] + x];
+        h[(num_cells[1] + 1) * num_cells[0] + x] = h[num_cells[1] * num_cells[0] + x];
+        // Momentum in x direction
+        hu[x] = hu[num_cells[0] + x];
+        hu[(num_cells[1] + 1) * num_cells[0] + x] = hu[num_cells[1] * num_cells[0] + x];
+        // Momentum in y direction
+        hv[x] = boundary::ghost_momentum(hv[num_cells[0] + x]);
+        hv[(num_cells[1] + 1) * num_cells[0] + x] = boundary::ghost_momentum(hv[num_cells[1] * num_cells[0] + x]);
+    }
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeSweeps(bool &error_happened) -> real {
+    // Net updates are kept in the workspace. They are not cleared between steps: every value read by an update loop
+    // is written by the preceding sweep (batches also write zeros for dry edges, borders only matter for wet cells).
+    // Only edges next to wet cells are solved, edges between two dry cells would have no updates.
+    real max_wave_speed{0.F};
+    bool negative_height{false};
+    std::uint32_t invalid_lanes{0};
+    if (precompute_cell_terms) { computeCellTerms<isa>(hu); }
+    // X Sweep, rows only depend on themselves. Cell terms are computed by the thread sweeping their rows.
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = row_chunks[chunk]; y < row_chunks[chunk + 1]; ++y) {
+            // First cell of this row
+            const std::size_t row{y * num_cells[0]};
+
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+                const std::size_t begin{wet_spans[span][0]};
+                const std::size_t end{wet_spans[span][1]};
+
+                // Left border
+                if (begin == row) {
+                    const std::array<real, 5> result{solve<real>({b[row], h[row], boundary::ghost_momentum(hu[row]),
+                                                             b[row], h[row], hu[row]}, invalid_lanes)};
+                    h_updates_pos[row + y] = result[2];
+                    hu_updates_pos[row + y] = result[3];
+                    max_wave_speed = std::max<real>(max_wave_speed, result[4]);
+                }
+
+                // Inner edges in batches, edge x lies between cells x - 1 and x. The edges towards dry neighbours
+                // belong to the span.
+                const std::size_t first_edge{std::max<std::size_t>(begin, row + 1)};
+                const std::size_t end_edge{std::min<std::size_t>(end + 1, row + num_cells[0])};
+                for (std::size_t index_r = first_edge; index_r < end_edge; index_r += solver_batch_size) {
+                    const std::size_t count{std::min<std::size_t>(solver_batch_size, end_edge - index_r)};
+                    const std::size_t index_l{index_r - 1};
+                    max_wave_speed = std::max<real>(
+                            max_wave_speed,
+                            precompute_cell_terms
+                            ? solve_batch_precomputed(count, x_edges, index_r + y,
+                                                      lanes_at(h, index_l), lanes_at(hu, index_l),
+                                                      &cell_velocity[index_l], &cell_sqrt_h[index_l],
+                                                      lanes_at(h, index_r), lanes_at(hu, index_r),
+                                                      &cell_velocity[index_r], &cell_sqrt_h[index_r],
+                                                      &h_updates_neg[index_r + y], &hu_updates_neg[index_r + y],
+                                                      &h_updates_pos[index_r + y], &hu_updates_pos[index_r + y],
+                                                      invalid_lanes)
+                            : solve_batch(count, x_edges, index_r + y,
+                                          lanes_at(h, index_l), lanes_at(hu, index_l),
+                                          lanes_at(h, index_r), lanes_at(hu, index_r),
+                                          &h_updates_neg[index_r + y], &hu_updates_neg[index_r + y],
+                                          &h_updates_pos[index_r + y], &hu_updates_pos[index_r + y],
+                                          invalid_lanes));
+                }
+
+                // Right border
+                const std::size_t index_l{row + num_cells[0] - 1};
+                if (end == index_l + 1) {
+                    const std::array<real, 5> result{solve<real>({b[index_l], h[index_l], hu[index_l],
+                                                             b[index_l], h[index_l],
+                                                             boundary::ghost_momentum(hu[index_l])}, invalid_lanes)};
+                    h_updates_neg[index_l + 1 + y] = result[0];
+                    hu_updates_neg[index_l + 1 + y] = result[1];
+                    max_wave_speed = std::max<real>(max_wave_speed, result[4]);
+                }
+            }
+
+            // Failures are rare, the row is only searched once it had one
+            if (invalid_lanes != 0) { recordFailure(h, row, row, num_cells[0], 0); }
+        }
+    }
+
+    // Calculate timestep size from the fastest wave of all threads
+    const real timestep{.4F * cell_size[0] / reduceTeam({max_wave_speed, false}).max_wave_speed};
+
+    // Apply updates, each thread to the rows it swept
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = row_chunks[chunk]; y < row_chunks[chunk + 1]; ++y) {
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+#pragma omp simd reduction(|| : negative_height)
+                for (std::size_t index = wet_spans[span][0]; index < wet_spans[span][1]; ++index) {
+                    h[index] -= timestep / cell_size[0] * (h_updates_pos[index + y] + h_updates_neg[index + y + 1]);
+                    hu[index] = hu[index] - timestep / cell_size[0] *
+                                            (hu_updates_pos[index + y] + hu_updates_neg[index + y + 1]);
+                    negative_height = negative_height || h[index] <= 0.F;
+                }
+            }
+            if (negative_height) { recordFailure(h, y * num_cells[0], y * num_cells[0], num_cells[0], 0); }
+        }
+    }
+
+    if (precompute_cell_terms) { computeCellTerms<isa>(hv); }
+    // Y Sweep, edges of row y lie between rows y and y + 1. The row above may belong to another thread, so all updates
+    // have to be done first.
+#pragma omp barrier
+#pragma omp for schedule(static)
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = row_chunks[chunk]; y < std::min<std::size_t>(row_chunks[chunk + 1], num_cells[1] + 1);
+             ++y) {
+            for (std::size_t span = edge_span_rows[y]; span < edge_span_rows[y + 1]; ++span) {
+                // Edges between this row and the next one in batches
+                for (std::size_t index_b = edge_spans[span][0]; index_b < edge_spans[span][1];
+                     index_b += solver_batch_size) {
+                    const std::size_t count{std::min<std::size_t>(solver_batch_size, edge_spans[span][1] - index_b)};
+                    const std::size_t index_t{index_b + num_cells[0]};
+                    if (precompute_cell_terms) {
+                        solve_batch_precomputed(count, y_edges, index_b,
+                                                lanes_at(h, index_b), lanes_at(hv, index_b),
+                                                &cell_velocity[index_b], &cell_sqrt_h[index_b],
+                                                lanes_at(h, index_t), lanes_at(hv, index_t),
+                                                &cell_velocity[index_t], &cell_sqrt_h[index_t],
+                                                &h_updates_neg[index_b], &hu_updates_neg[index_b],
+                                                &h_updates_pos[index_b], &hu_updates_pos[index_b], invalid_lanes);
+                    } else {
+                        solve_batch(count, y_edges, index_b,
+                                    lanes_at(h, index_b), lanes_at(hv, index_b),
+                                    lanes_at(h, index_t), lanes_at(hv, index_t),
+                                    &h_updates_neg[index_b], &hu_updates_neg[index_b],
+                                    &h_updates_pos[index_b], &hu_updates_pos[index_b], invalid_lanes);
+                    }
+                }
+            }
+            if (invalid_lanes != 0) { recordFailure(h, y * num_cells[0], y * num_cells[0], 2 * num_cells[0], 1); }
+        }
+    }
+
+    // Apply updates
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = std::max<std::size_t>(row_chunks[chunk], 1);
+             y < std::min<std::size_t>(row_chunks[chunk + 1], num_cells[1] + 1); ++y) {
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+#pragma omp simd reduction(|| : negative_height)
+                for (std::size_t index = wet_spans[span][0]; index < wet_spans[span][1]; ++index) {
+                    h[index] -= timestep / cell_size[1] * (h_updates_pos[index - num_cells[0]] + h_updates_neg[index]);
+                    hv[index] = hv[index] - timestep / cell_size[1] *
+                                            (hu_updates_pos[index - num_cells[0]] + hu_updates_neg[index]);
+                    negative_height = negative_height || h[index] <= 0.F;
+                }
+            }
+            if (negative_height) { recordFailure(h, y * num_cells[0], y * num_cells[0], num_cells[0], 1); }
+        }
+    }
+
+    if (reduceTeam({0.F, negative_height || invalid_lanes != 0}).failed) { error_happened = true; }
+    return timestep;
+}
+
+template <typename precision, typename layout>
+template <typename isa, typename momenta>
+SWE_TARGET void basic_simulation<precision, layout>::computeCellTerms(const momenta &momentum) {
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t span = wet_span_rows[row_chunks[chunk]]; span < wet_span_rows[row_chunks[chunk + 1]]; ++span) {
+#pragma omp simd
+            for (std::size_t index = wet_spans[span][0]; index < wet_spans[span][1]; ++index) {
+                cell_velocity[index] = momentum[index] / h[index];
+                cell_sqrt_h[index] = std::sqrt(h[index]);
+            }
+        }
+    }
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeMaxWaveSpeed() const -> real {
+    real max_wave_speed{0.F};
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = row_chunks[chunk]; y < row_chunks[chunk + 1]; ++y) {
+            const std::size_t row{y * num_cells[0]};
+            const std::size_t last{row + num_cells[0] - 1};
+
+            // Invalid cells are reported by the sweeps
+            std::uint32_t invalid_lanes{0};
+
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+                // Border edges, see computeSweeps
+                if (wet_spans[span][0] == row) {
+                    max_wave_speed = std::max<real>(max_wave_speed,
+                                                     solve<real>({b[row], h[row], boundary::ghost_momentum(hu[row]),
+                                                            b[row], h[row], hu[row]}, invalid_lanes)[4]);
+                }
+                if (wet_spans[span][1] == last + 1) {
+                    max_wave_speed = std::max<real>(max_wave_speed,
+                                                     solve<real>({b[last], h[last], hu[last],
+                                                            b[last], h[last],
+                                                            boundary::ghost_momentum(hu[last])}, invalid_lanes)[4]);
+                }
+
+                // Inner edges of the span
+                const std::size_t first_edge{std::max<std::size_t>(wet_spans[span][0], row + 1)};
+                const std::size_t end_edge{std::min<std::size_t>(wet_spans[span][1] + 1, last + 1)};
+                for (std::size_t index_r = first_edge; index_r < end_edge; index_r += solver_batch_size) {
+                    const std::size_t count{std::min<std::size_t>(solver_batch_size, end_edge - index_r)};
+                    const std::size_t index_l{index_r - 1};
+                    max_wave_speed = std::max<real>(max_wave_speed,
+                                                     wave_speed_batch(count, x_edges, index_r + y,
+                                                                      lanes_at(h, index_l), lanes_at(hu, index_l),
+                                                                      lanes_at(h, index_r), lanes_at(hu, index_r)));
+                }
+            }
+        }
+    }
+    return max_wave_speed;
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeFusedSweeps(bool &error_happened) -> real {
+    // The timestep has to be known before the first cell is updated, so wave speeds get their own pass
+    const real timestep{.4F * cell_size[0] /
+                        reduceTeam({computeMaxWaveSpeed<boundary, isa>(), false}).max_wave_speed};
+    const real timestep_x{timestep / cell_size[0]};
+    const real timestep_y{timestep / cell_size[1]};
+    bool negative_height{false};
+    std::uint32_t invalid_lanes{0};
+
+    // X Sweep and updates. Each wet span is streamed once: a batch of edges is solved from the old cell values, then
+    // the cells left of these edges are updated. The net update of the last edge for the cell right of it is carried
+    // over to the next batch, which still needs the old value of that cell. Rows are swept by chunk, like the cells
+    // were first touched.
+#pragma omp for schedule(static)
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        for (std::size_t y = row_chunks[chunk]; y < row_chunks[chunk + 1]; ++y) {
+            const std::size_t row{y * num_cells[0]};
+            const std::size_t last{row + num_cells[0] - 1};
+
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+                const std::size_t begin{wet_spans[span][0]};
+                const std::size_t end{wet_spans[span][1]};
+
+                // Net updates of the current batch. Index 0 of the right going updates holds the carry.
+                std::array<real, solver_batch_size> h_neg{};
+                std::array<real, solver_batch_size> hu_neg{};
+                std::array<real, solver_batch_size + 1> h_pos{};
+                std::array<real, solver_batch_size + 1> hu_pos{};
+
+                // Left border, otherwise the first batch starts with the edge from the dry cell in front of the span
+                if (begin == row) {
+                    const std::array<real, 5> result{solve<real>({b[row], h[row], boundary::ghost_momentum(hu[row]),
+                                                             b[row], h[row], hu[row]}, invalid_lanes)};
+                    h_pos[0] = result[2];
+                    hu_pos[0] = result[3];
+                }
+
+                // Inner edges in batches, then update the cells left of them
+                const std::size_t first_edge{std::max<std::size_t>(begin, row + 1)};
+                const std::size_t end_edge{std::min<std::size_t>(end + 1, last + 1)};
+                for (std::size_t index_r = first_edge; index_r < end_edge; index_r += solver_batch_size) {
+                    const std::size_t count{std::min<std::size_t>(solver_batch_size, end_edge - index_r)};
+                    const std::size_t index_l{index_r - 1};
+                    solve_batch(count, x_edges, index_r + y,
+                                lanes_at(h, index_l), lanes_at(hu, index_l),
+                                lanes_at(h, index_r), lanes_at(hu, index_r),
+                                h_neg.data(), hu_neg.data(), &h_pos[1], &hu_pos[1], invalid_lanes);
+
+                    // Failures are rare, cells are only searched once there was one. Invalid cells before they are
+                    // updated.
+                    if (invalid_lanes != 0) { recordFailure(h, index_l, index_l, count + 1, 0); }
+#pragma omp simd reduction(|| : negative_height)
+                    for (std::size_t i = 0; i < count; ++i) {
+                        const bool wet{b[index_l + i] < 0.F};
+                        const real new_h{h[index_l + i] - timestep_x * (h_pos[i] + h_neg[i])};
+                        const real new_hu{hu[index_l + i] - timestep_x * (hu_pos[i] + hu_neg[i])};
+                        h[index_l + i] = wet ? new_h : h[index_l + i];
+                        hu[index_l + i] = wet ? new_hu : real{hu[index_l + i]};
+                        negative_height = negative_height || (wet && new_h <= 0.F);
+                    }
+                    h_pos[0] = h_pos[count];
+                    hu_pos[0] = hu_pos[count];
+                }
+
+                // Right border and last cell
+                if (end == last + 1) {
+                    const std::array<real, 5> result{solve<real>({b[last], h[last], hu[last],
+                                                             b[last], h[last], boundary::ghost_momentum(hu[last])},
+                                                            invalid_lanes)};
+                    h[last] -= timestep_x * (h_pos[0] + result[0]);
+                    hu[last] = hu[last] - timestep_x * (hu_pos[0] + result[1]);
+                    negative_height = negative_height || h[last] <= 0.F;
+                }
+            }
+
+            if (negative_height) { recordFailure(h, row, row, num_cells[0], 0); }
+        }
+    }
+
+    // Y Sweep and updates. Works like the x sweep, but each chunk walks upwards through its rows, so a whole row of
+    // upward going net updates is carried over. Ghost rows only provide input. The row of edges below a chunk reads
+    // the last row of the chunk below, so these rows are solved before any cell is updated.
+#pragma omp for schedule(static)
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        const std::size_t y{row_chunks[chunk] - 1};
+        if (row_chunks[chunk] == 0 || y > num_cells[1]) { continue; }
+        real *updates{fused_updates + chunk * fused_update_rows * num_cells[0]};
+        real *updates_below{updates - fused_update_rows * num_cells[0]};
+        real *carry{updates + (2 + 2 * (y % 2)) * num_cells[0]};
+        solveFusedEdgeRow<isa>(y, updates_below + 6 * num_cells[0], updates_below + 7 * num_cells[0], carry,
+                               carry + num_cells[0], invalid_lanes);
+        if (invalid_lanes != 0) { recordFailure(h, y * num_cells[0], y * num_cells[0], 2 * num_cells[0], 1); }
+    }
+
+#pragma omp for schedule(static) nowait
+    for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+        real *updates{fused_updates + chunk * fused_update_rows * num_cells[0]};
+        const std::size_t end{std::min<std::size_t>(row_chunks[chunk + 1], num_cells[1] + 1)};
+        for (std::size_t y = row_chunks[chunk]; y < end; ++y) {
+            // The upward going net updates of consecutive rows of edges take turns in two rows of updates. The
+            // row of edges above the last row of the chunk was solved by the next chunk.
+            const bool above_solved{y + 1 == row_chunks[chunk + 1]};
+            real *h_neg{updates + (above_solved ? 6 : 0) * num_cells[0]};
+            real *hv_neg{h_neg + num_cells[0]};
+            real *h_pos{updates + (2 + 2 * (y % 2)) * num_cells[0]};
+            real *hv_pos{h_pos + num_cells[0]};
+            const real *h_carry{updates + (2 + 2 * ((y + 1) % 2)) * num_cells[0]};
+            const real *hv_carry{h_carry + num_cells[0]};
+            if (!above_solved) {
+                solveFusedEdgeRow<isa>(y, h_neg, hv_neg, h_pos, hv_pos, invalid_lanes);
+                if (invalid_lanes != 0) {
+                    recordFailure(h, y * num_cells[0], y * num_cells[0], 2 * num_cells[0], 1);
+                }
+            }
+
+            // Update this row, except for the bottom ghost row
+            if (y == 0) { continue; }
+            const std::size_t row{y * num_cells[0]};
+            for (std::size_t span = wet_span_rows[y]; span < wet_span_rows[y + 1]; ++span) {
+#pragma omp simd reduction(|| : negative_height)
+                for (std::size_t index = wet_spans[span][0]; index < wet_spans[span][1]; ++index) {
+                    const std::size_t x{index - row};
+                    h[index] -= timestep_y * (h_carry[x] + h_neg[x]);
+                    hv[index] = hv[index] - timestep_y * (hv_carry[x] + hv_neg[x]);
+                    negative_height = negative_height || h[index] <= 0.F;
+                }
+            }
+            if (negative_height) { recordFailure(h, row, row, num_cells[0], 1); }
+        }
+    }
+
+    if (reduceTeam({0.F, negative_height || invalid_lanes != 0}).failed) { error_happened = true; }
+    return timestep;
+}
+
+template <typename precision, typename layout>
+template <typename isa>
+SWE_TARGET void basic_simulation<precision, layout>::solveFusedEdgeRow(const std::size_t &y, real *h_neg, real *hv_neg,
+                                                                        real *h_pos, real *hv_pos,
+                                                                        std::uint32_t &invalid_lanes) {
+    const std::size_t row{y * num_cells[0]};
+    for (std::size_t span = edge_span_rows[y]; span < edge_span_rows[y + 1]; ++span) {
+        for (std::size_t index_b = edge_spans[span][0]; index_b < edge_spans[span][1]; index_b += solver_batch_size) {
+            const std::size_t count{std::min<std::size_t>(solver_batch_size, edge_spans[span][1] - index_b)};
+            const std::size_t index_t{index_b + num_cells[0]};
+            const std::size_t x{index_b - row};
+            solve_batch(count, y_edges, index_b,
+                        lanes_at(h, index_b), lanes_at(hv, index_b),
+                        lanes_at(h, index_t), lanes_at(hv, index_t),
+                        &h_neg[x], &hv_neg[x], &h_pos[x], &hv_pos[x], invalid_lanes);
+        }
+    }
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeTiledSweeps(bool &error_happened) -> real {
+    // The timestep has to be known before the first tile is done, so wave speeds get their own pass
+#pragma omp single
+    updateActiveTiles(1);
+    const real timestep{.4F * cell_size[0] / computeTileWaveSpeeds<boundary, isa>()};
+    const real timestep_x{timestep / cell_size[0]};
+    const real timestep_y{timestep / cell_size[1]};
+    bool negative_height{false};
+
+    // Tiles without wet cells or without moving water nearby don't change and are skipped
+#pragma omp for schedule(static) nowait
+    for (std::size_t i = 0; i < active_tiles.size(); ++i) {
+        const auto [start, end] = tileBounds(active_tiles[i]);
+        bool moving{false};
+        negative_height = sweepTile<boundary, isa>(start, end, timestep_x, timestep_y,
+                                                   tile_scratch[static_cast<std::size_t>(omp_get_thread_num())],
+                                                   moving) ||
+                          negative_height;
+        tile_moving_next[active_tiles[i]] = moving;
+    }
+    const bool failed{reduceTeam({0.F, negative_height}).failed};
+
+    // New cells become current cells. Bathymetry is swapped along, layouts may keep it next to the other quantities.
+#pragma omp single
+    {
+        std::swap(b, b_next);
+        std::swap(h, h_next);
+        std::swap(hu, hu_next);
+        std::swap(hv, hv_next);
+        tile_moving.swap(tile_moving_next);
+    }
+
+    if (failed) { error_happened = true; }
+    return timestep;
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET bool basic_simulation<precision, layout>::sweepTile(const std::array<std::size_t, 2> &start,
+                                                    const std::array<std::size_t, 2> &end,
+                                                    const real &timestep_x,
+                                                    const real &timestep_y,
+                                                    real *tile,
+                                                    bool &moving) {
+    bool negative_height{false};
+    std::uint32_t invalid_lanes{0};
+    const std::size_t width{end[0] - start[0]};
+    const std::size_t height{end[1] - start[1]};
+
+    // Cells after the x sweep, for the tile and one halo row below and above it
+    real *const tile_h{tile};
+    real *const tile_hu{tile_h + (tile_size[1] + 2) * tile_size[0]};
+
+    // Net updates of one row of edges
+    real *const h_neg{tile_hu + (tile_size[1] + 2) * tile_size[0]};
+    real *const hu_neg{h_neg + tile_size[0] + 1};
+    real *const h_pos{hu_neg + tile_size[0] + 1};
+    real *const hu_pos{h_pos + tile_size[0] + 1};
+
+    // Upward net updates carried over from the row of edges below
+    real *const h_carry{hu_pos + tile_size[0] + 1};
+    real *const hv_carry{h_carry + tile_size[0]};
+
+    // X Sweep on the tile rows and the halo rows. Edge i of the tile lies left of cell start[0] + i.
+    for (std::size_t row_y = 0; row_y < height + 2; ++row_y) {
+        const std::size_t row{(start[1] - 1 + row_y) * num_cells[0]};
+
+        // Left edge of the tile, either the left border or an inner edge
+        h_pos[0] = hu_pos[0] = 0.F;
+        const std::size_t first{row + start[0]};
+        if (start[0] == 0 && b[first] < 0.F) {
+            const std::array<real, 5> result{solve<real>({b[first], h[first], boundary::ghost_momentum(hu[first]),
+                                                     b[first], h[first], hu[first]}, invalid_lanes)};
+            h_pos[0] = result[2];
+            hu_pos[0] = result[3];
+        }
+
+        // Right edge of the tile, only the right border needs special treatment
+        h_neg[width] = hu_neg[width] = 0.F;
+        const std::size_t last{row + end[0] - 1};
+        if (end[0] == num_cells[0] && b[last] < 0.F) {
+            const std::array<real, 5> result{solve<real>({b[last], h[last], hu[last],
+                                                     b[last], h[last], boundary::ghost_momentum(hu[last])},
+                                                    invalid_lanes)};
+            h_neg[width] = result[0];
+            hu_neg[width] = result[1];
+        }
+
+        // Inner edges in batches
+        const std::size_t edge_start{start[0] == 0 ? std::size_t{1} : std::size_t{0}};
+        const std::size_t edge_end{end[0] == num_cells[0] ? width : width + 1};
+        for (std::size_t i = edge_start; i < edge_end; i += solver_batch_size) {
+            const std::size_t count{std::min<std::size_t>(solver_batch_size, edge_end - i)};
+            const std::size_t index_r{row + start[0] + i};
+            const std::size_t index_l{index_r - 1};
+            solve_batch(count, x_edges, index_r + start[1] - 1 + row_y,
+                        lanes_at(h, index_l), lanes_at(hu, index_l),
+                        lanes_at(h, index_r), lanes_at(hu, index_r),
+                        &h_neg[i], &hu_neg[i], &h_pos[i], &hu_pos[i], invalid_lanes);
+        }
+
+        // Failures are rare, cells are only searched once there was one. Neighbouring tiles search their own cells.
+        if (invalid_lanes != 0) { recordFailure(h, first, first, width, 0); }
+
+        // Apply updates into the tile. Water moves, if any net updates of the tile itself don't cancel out.
+        const bool in_tile{row_y > 0 && row_y <= height};
+#pragma omp simd
+        for (std::size_t i = 0; i < width; ++i) {
+            const std::size_t index{row + start[0] + i};
+            const bool wet{b[index] < 0.F};
+            tile_h[row_y * width + i] = wet ? h[index] - timestep_x * (h_pos[i] + h_neg[i + 1]) : h[index];
+            tile_hu[row_y * width + i] = wet ? hu[index] - timestep_x * (hu_pos[i] + hu_neg[i + 1]) : real{hu[index]};
+            negative_height = negative_height || (wet && tile_h[row_y * width + i] <= 0.F);
+            moving = moving || (wet && in_tile && (h_pos[i] + h_neg[i + 1] != 0.F || hu_pos[i] + hu_neg[i + 1] != 0.F));
+        }
+        if (negative_height) { recordFailure(tile_h, row_y * width, first, width, 0); }
+    }
+
+    // Y Sweep on the tile, walking upwards and carrying the upward net updates to the next row
+    for (std::size_t row_y = 0; row_y <= height; ++row_y) {
+        const std::size_t row_b{(start[1] - 1 + row_y) * num_cells[0] + start[0]};
+        const std::size_t row_t{row_b + num_cells[0]};
+
+        // Edges between this row and the next one in batches
+        for (std::size_t i = 0; i < width; i += solver_batch_size) {
+            const std::size_t count{std::min<std::size_t>(solver_batch_size, width - i)};
+            solve_batch(count, y_edges, row_b + i,
+                        &tile_h[row_y * width + i], lanes_at(hv, row_b + i),
+                        &tile_h[(row_y + 1) * width + i], lanes_at(hv, row_t + i),
+                        &h_neg[i], &hu_neg[i], &h_pos[i], &hu_pos[i], invalid_lanes);
+        }
+        if (invalid_lanes != 0) {
+            recordFailure(tile_h, row_y * width, row_b, width, 1);
+            recordFailure(tile_h, (row_y + 1) * width, row_t, width, 1);
+        }
+
+        // Write this row into the new cells, except for the halo row below the tile
+        if (row_y > 0) {
+#pragma omp simd
+            for (std::size_t i = 0; i < width; ++i) {
+                const std::size_t index{row_b + i};
+                const bool wet{b[index] < 0.F};
+                const real new_h{tile_h[row_y * width + i] - timestep_y * (h_carry[i] + h_neg[i])};
+                h_next[index] = wet ? new_h : tile_h[row_y * width + i];
+                hu_next[index] = tile_hu[row_y * width + i];
+                hv_next[index] = wet ? hv[index] - timestep_y * (hv_carry[i] + hu_neg[i]) : real{hv[index]};
+                negative_height = negative_height || (wet && new_h <= 0.F);
+                moving = moving || (wet && (h_carry[i] + h_neg[i] != 0.F || hv_carry[i] + hu_neg[i] != 0.F));
+            }
+        }
+#pragma omp simd
+        for (std::size_t i = 0; i < width; ++i) {
+            h_carry[i] = h_pos[i];
+            hv_carry[i] = hu_pos[i];
+        }
+        if (negative_height && row_y > 0) { recordFailure(h_next, row_b, row_b, width, 1); }
+    }
+
+    return negative_height || invalid_lanes != 0;
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeTemporalSweeps(bool &error_happened) -> real {
+    // One timestep size for the whole block, leaving room for waves speeding up. Waves travel less than one cell per
+    // step, so tiles further than that many cells away from moving water stay at rest.
+#pragma omp single
+    updateActiveTiles(time_block_steps);
+    const real max_wave_speed{computeTileWaveSpeeds<boundary, isa>()};
+    const real timestep{.4F * cell_size[0] / (time_block_speed_margin * max_wave_speed)};
+    const real timestep_x{timestep / cell_size[0]};
+    const real timestep_y{timestep / cell_size[1]};
+
+    // Don't run far past the end of the simulation
+    const std::size_t steps{std::clamp<std::size_t>(static_cast<std::size_t>(std::ceil((duration - time) / timestep)),
+                                                    1, time_block_steps)};
+
+    bool negative_height{false};
+    real block_wave_speed{0.F};
+
+    // Tiles without wet cells or without moving water nearby don't change and are skipped
+#pragma omp for schedule(static) nowait
+    for (std::size_t i = 0; i < active_tiles.size(); ++i) {
+        const auto [start, end] = tileBounds(active_tiles[i]);
+        bool moving{false};
+        negative_height = sweepTileSteps<boundary, isa>(start, end, steps, timestep_x, timestep_y,
+                                                        tile_scratch[static_cast<std::size_t>(omp_get_thread_num())],
+                                                        block_wave_speed, moving) || negative_height;
+        tile_moving_next[active_tiles[i]] = moving;
+    }
+    const team_result block{reduceTeam({block_wave_speed, negative_height})};
+
+    // Waves got too fast for the timestep size or not finite, or a cell failed and the tiled kernel should find the
+    // timestep it failed in. The current cells are still untouched, so redo the block step by step. Skipped tiles rely
+    // on their new cells matching the current ones, so the new cells are reset.
+    if (block.failed || !(block.max_wave_speed <= time_block_speed_margin * max_wave_speed)) {
+#pragma omp for schedule(static)
+        for (std::size_t i = 0; i < active_tiles.size(); ++i) {
+            const auto [start, end] = tileBounds(active_tiles[i]);
+            for (std::size_t y = start[1]; y < end[1]; ++y) {
+                const std::size_t row{y * num_cells[0]};
+                for (std::size_t index{row + start[0]}; index < row + end[0]; ++index) {
+                    h_next[index] = h[index];
+                    hu_next[index] = hu[index];
+                    hv_next[index] = hv[index];
+                }
+            }
+        }
+        real passed{computeTiledSweeps<boundary, isa>(error_happened)};
+        for (std::size_t step{1}; step < steps && !error_happened; ++step) {
+            updateGhostRows<boundary, isa>();
+#pragma omp barrier
+            passed += computeTiledSweeps<boundary, isa>(error_happened);
+        }
+        return passed;
+    }
+
+    // New cells become current cells. Bathymetry is swapped along, layouts may keep it next to the other quantities.
+#pragma omp single
+    {
+        std::swap(b, b_next);
+        std::swap(h, h_next);
+        std::swap(hu, hu_next);
+        std::swap(hv, hv_next);
+        tile_moving.swap(tile_moving_next);
+    }
+    return static_cast<real>(steps) * timestep;
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET bool basic_simulation<precision, layout>::sweepTileSteps(const std::array<std::size_t, 2> &start,
+                                                         const std::array<std::size_t, 2> &end,
+                                                         const std::size_t &steps,
+                                                         const real &timestep_x,
+                                                         const real &timestep_y,
+                                                         real *tile,
+                                                         real &max_wave_speed,
+                                                         bool &moving) {
+    bool negative_height{false};
+    bool not_finite{false};
+    std::uint32_t invalid_lanes{0};
+
+    // Tile with one halo cell per step on each side, limited to the grid including its ghost rows
+    const std::array<std::size_t, 2> ext_start{start[0] - std::min(start[0], steps),
+                                               start[1] - std::min(start[1], steps)};
+    const std::array<std::size_t, 2> ext_end{std::min(end[0] + steps, num_cells[0]),
+                                             std::min(end[1] + steps, num_cells[1] + 2)};
+    const std::size_t width{ext_end[0] - ext_start[0]};
+    const std::size_t height{ext_end[1] - ext_start[1]};
+
+    // Which sides of the copy are borders of the grid
+    const bool left_border{ext_start[0] == 0};
+    const bool right_border{ext_end[0] == num_cells[0]};
+    const bool bottom_ghost{ext_start[1] == 0};
+    const bool top_ghost{ext_end[1] == num_cells[1] + 2};
+
+    // The tile itself within the copy, water moves if any net updates there don't cancel out
+    const std::size_t tile_left{start[0] - ext_start[0]};
+    const std::size_t tile_right{end[0] - ext_start[0]};
+    const std::size_t tile_bottom{start[1] - ext_start[1]};
+    const std::size_t tile_top{end[1] - ext_start[1]};
+
+    // Copy of the cells
+    const std::size_t max_cells{(tile_size[0] + 2 * time_block_steps) * (tile_size[1] + 2 * time_block_steps)};
+    real *const tile_h{tile};
+    real *const tile_hu{tile_h + max_cells};
+    real *const tile_hv{tile_hu + max_cells};
+
+    // Net updates of one row of edges
+    const std::size_t max_width{tile_size[0] + 2 * time_block_steps};
+    real *const h_neg{tile_hv + max_cells};
+    real *const hu_neg{h_neg + max_width + 1};
+    real *const h_pos{hu_neg + max_width + 1};
+    real *const hu_pos{h_pos + max_width + 1};
+
+    // Upward net updates carried over from the row of edges below
+    real *const h_carry{hu_pos + max_width + 1};
+    real *const hv_carry{h_carry + max_width};
+
+    for (std::size_t row_y = 0; row_y < height; ++row_y) {
+        const std::size_t row{(ext_start[1] + row_y) * num_cells[0] + ext_start[0]};
+        for (std::size_t i = 0; i < width; ++i) {
+            tile_h[row_y * width + i] = h[row + i];
+            tile_hu[row_y * width + i] = hu[row + i];
+            tile_hv[row_y * width + i] = hv[row + i];
+        }
+    }
+
+    for (std::size_t step = 0; step < steps; ++step) {
+        // Cells whose values are still exact after each sweep of this step, only sides inside the grid lose cells. Only
+        // edges between exact cells count for the wave speed, the halo may hold anything.
+        const std::size_t exact_left{left_border ? 0 : step};
+        const std::size_t exact_right{right_border ? width : width - step};
+        const std::size_t valid_left{left_border ? 0 : step + 1};
+        const std::size_t valid_right{right_border ? width : width - step - 1};
+        const std::size_t x_valid_bottom{bottom_ghost ? 0 : step};
+        const std::size_t x_valid_top{top_ghost ? height : height - step};
+        const std::size_t valid_bottom{bottom_ghost ? 0 : step + 1};
+        const std::size_t valid_top{top_ghost ? height : height - step - 1};
+
+        // Ghost rows as in updateGhostRows
+        if (bottom_ghost) {
+            for (std::size_t i = 0; i < width; ++i) {
+                tile_h[i] = tile_h[width + i];
+                tile_hu[i] = tile_hu[width + i];
+                tile_hv[i] = boundary::ghost_momentum(tile_hv[width + i]);
+            }
+        }
+        if (top_ghost) {
+            const std::size_t ghost{(height - 1) * width};
+            for (std::size_t i = 0; i < width; ++i) {
+                tile_h[ghost + i] = tile_h[ghost - width + i];
+                tile_hu[ghost + i] = tile_hu[ghost - width + i];
+                tile_hv[ghost + i] = boundary::ghost_momentum(tile_hv[ghost - width + i]);
+            }
+        }
+
+        // X Sweep, edge i lies left of cell i. Edges of the copy inside the grid get no updates, like outflow borders.
+        for (std::size_t row_y = 0; row_y < height; ++row_y) {
+            const std::size_t row{(ext_start[1] + row_y) * num_cells[0] + ext_start[0]};
+            real *const row_h{&tile_h[row_y * width]};
+            real *const row_hu{&tile_hu[row_y * width]};
+            const bool valid_row{row_y >= x_valid_bottom && row_y < x_valid_top};
+
+            // Left border
+            h_pos[0] = hu_pos[0] = 0.F;
+            if (left_border && b[row] < 0.F) {
+                const std::array<real, 5> result{solve<real>({b[row], row_h[0], boundary::ghost_momentum(row_hu[0]),
+                                                         b[row], row_h[0], row_hu[0]}, invalid_lanes)};
+                h_pos[0] = result[2];
+                hu_pos[0] = result[3];
+                max_wave_speed = valid_row ? std::max<real>(max_wave_speed, result[4]) : max_wave_speed;
+            }
+
+            // Right border
+            h_neg[width] = hu_neg[width] = 0.F;
+            const std::size_t last{width - 1};
+            if (right_border && b[row + last] < 0.F) {
+                const std::array<real, 5> result{solve<real>({b[row + last], row_h[last], row_hu[last],
+                                                         b[row + last], row_h[last],
+                                                         boundary::ghost_momentum(row_hu[last])}, invalid_lanes)};
+                h_neg[width] = result[0];
+                hu_neg[width] = result[1];
+                max_wave_speed = valid_row ? std::max<real>(max_wave_speed, result[4]) : max_wave_speed;
+            }
+
+            // Inner edges in batches, which end where the edges between exact cells begin and end
+            for (std::size_t i = 1; i < width;) {
+                const std::size_t limit{i <= exact_left ? exact_left + 1 : i < exact_right ? exact_right : width};
+                const std::size_t count{std::min<std::size_t>({solver_batch_size, limit - i, width - i})};
+                const real speed{solve_batch(count, x_edges, row + ext_start[1] + row_y + i,
+                                             &row_h[i - 1], &row_hu[i - 1],
+                                             &row_h[i], &row_hu[i],
+                                             &h_neg[i], &hu_neg[i], &h_pos[i], &hu_pos[i],
+                                             invalid_lanes)};
+                const bool exact{valid_row && i > exact_left && i < exact_right};
+                max_wave_speed = exact ? std::max<real>(max_wave_speed, speed) : max_wave_speed;
+                i += count;
+            }
+
+            // Apply updates, updates of exact cells are not finite if their wave speeds weren't
+            const bool tile_row{row_y >= tile_bottom && row_y < tile_top};
+#pragma omp simd
+            for (std::size_t i = 0; i < width; ++i) {
+                const bool wet{b[row + i] < 0.F};
+                const real new_h{row_h[i] - timestep_x * (h_pos[i] + h_neg[i + 1])};
+                const real new_hu{row_hu[i] - timestep_x * (hu_pos[i] + hu_neg[i + 1])};
+                row_h[i] = wet ? new_h : row_h[i];
+                row_hu[i] = wet ? new_hu : row_hu[i];
+                const bool valid{valid_row && i >= valid_left && i < valid_right};
+                negative_height = negative_height || (wet && valid && new_h <= 0.F);
+                not_finite = not_finite || (wet && valid && !(std::isfinite(new_h) && std::isfinite(new_hu)));
+                const bool in_tile{tile_row && i >= tile_left && i < tile_right};
+                moving = moving || (wet && in_tile && (h_pos[i] + h_neg[i + 1] != 0.F || hu_pos[i] + hu_neg[i + 1] != 0.F));
+            }
+        }
+
+        // Y Sweep, walking upwards and carrying the upward net updates to the next row. Ghost rows are not updated,
+        // the bottom and top rows of the copy inside the grid get no updates from outside it.
+        std::fill_n(h_carry, width, 0.F);
+        std::fill_n(hv_carry, width, 0.F);
+        for (std::size_t row_y = 0; row_y < height; ++row_y) {
+            const std::size_t row{(ext_start[1] + row_y) * num_cells[0] + ext_start[0]};
+            real *const row_h{&tile_h[row_y * width]};
+            real *const row_hv{&tile_hv[row_y * width]};
+
+            // Edges between this row and the next one in batches, which end where the edges between exact cells begin
+            // and end. Cells are exact in the columns the x sweep left exact.
+            if (row_y + 1 < height) {
+                const bool exact_rows{row_y >= x_valid_bottom && row_y + 1 < x_valid_top};
+                for (std::size_t i = 0; i < width;) {
+                    const std::size_t limit{i < valid_left ? valid_left : i < valid_right ? valid_right : width};
+                    const std::size_t count{std::min<std::size_t>({solver_batch_size, limit - i, width - i})};
+                    const real speed{solve_batch(count, y_edges, row + i,
+                                                 &row_h[i], &row_hv[i],
+                                                 &row_h[width + i], &row_hv[width + i],
+                                                 &h_neg[i], &hu_neg[i], &h_pos[i], &hu_pos[i], invalid_lanes)};
+                    const bool exact{exact_rows && i >= valid_left && i < valid_right};
+                    max_wave_speed = exact ? std::max<real>(max_wave_speed, speed) : max_wave_speed;
+                    i += count;
+                }
+            } else {
+                std::fill_n(h_neg, width, 0.F);
+                std::fill_n(hu_neg, width, 0.F);
+            }
+
+            // Update this row, except for ghost rows
+            const bool ghost{(bottom_ghost && row_y == 0) || (top_ghost && row_y + 1 == height)};
+            const bool valid_row{row_y >= valid_bottom && row_y < valid_top};
+            const bool tile_row{row_y >= tile_bottom && row_y < tile_top};
+#pragma omp simd
+            for (std::size_t i = 0; i < width; ++i) {
+                const bool wet{!ghost && b[row + i] < 0.F};
+                const real new_h{row_h[i] - timestep_y * (h_carry[i] + h_neg[i])};
+                const real new_hv{row_hv[i] - timestep_y * (hv_carry[i] + hu_neg[i])};
+                row_h[i] = wet ? new_h : row_h[i];
+                row_hv[i] = wet ? new_hv : row_hv[i];
+                const bool valid{valid_row && i >= valid_left && i < valid_right};
+                negative_height = negative_height || (wet && valid && new_h <= 0.F);
+                not_finite = not_finite || (wet && valid && !(std::isfinite(new_h) && std::isfinite(new_hv)));
+                const bool in_tile{tile_row && i >= tile_left && i < tile_right};
+                moving = moving || (wet && in_tile && (h_carry[i] + h_neg[i] != 0.F || hv_carry[i] + hu_neg[i] != 0.F));
+                h_carry[i] = h_pos[i];
+                hv_carry[i] = hu_pos[i];
+            }
+        }
+
+        // Only the first step solves exact cells everywhere. Later steps may see wrong halo cells, the cells that
+        // stay exact are covered by the checks of the updates.
+        negative_height = negative_height || (step == 0 && invalid_lanes != 0);
+    }
+
+    // The batches drop wave speeds that are not a number, but not the updates they lead to
+    if (not_finite) { max_wave_speed = std::numeric_limits<real>::infinity(); }
+
+    // Write the tile itself into the new cells
+    for (std::size_t y = start[1]; y < end[1]; ++y) {
+        const std::size_t local{(y - ext_start[1]) * width + start[0] - ext_start[0]};
+        const std::size_t row{y * num_cells[0]};
+        for (std::size_t i = 0; i < end[0] - start[0]; ++i) {
+            h_next[row + start[0] + i] = tile_h[local + i];
+            hu_next[row + start[0] + i] = tile_hu[local + i];
+            hv_next[row + start[0] + i] = tile_hv[local + i];
+        }
+    }
+
+    return negative_height;
+}
+
+template <typename precision, typename layout>
+template <typename boundary, typename isa>
+SWE_TARGET auto basic_simulation<precision, layout>::computeTileWaveSpeeds() -> real {
+    // Wave speeds of tiles at rest don't change, only active tiles are solved again
+#pragma omp for schedule(static)
+    for (std::size_t i = 0; i < active_tiles.size(); ++i) {
+        const auto [start, end] = tileBounds(active_tiles[i]);
+        real max_wave_speed{0.F};
+
+        // Invalid cells are reported by the sweeps
+        std::uint32_t invalid_lanes{0};
+
+        for (std::size_t y = start[1]; y < end[1]; ++y) {
+            const std::size_t row{y * num_cells[0]};
+            const std::size_t last{row + num_cells[0] - 1};
+
+            // Border edges, see computeSweeps
+            if (start[0] == 0 && b[row] < 0.F) {
+                max_wave_speed = std::max<real>(max_wave_speed,
+                                                 solve<real>({b[row], h[row], boundary::ghost_momentum(hu[row]),
+                                                        b[row], h[row], hu[row]}, invalid_lanes)[4]);
+            }
+            if (end[0] == num_cells[0] && b[last] < 0.F) {
+                max_wave_speed = std::max<real>(max_wave_speed,
+                                                 solve<real>({b[last], h[last], hu[last],
+                                                        b[last], h[last], boundary::ghost_momentum(hu[last])},
+                                                       invalid_lanes)[4]);
+            }
+
+            // Inner edges on both sides of every cell of the tile. Edges between tiles are solved twice, so that
+            // edges next to tiles without wet cells are included.
+            const std::size_t end_edge{row + std::min<std::size_t>(end[0] + 1, num_cells[0])};
+            for (std::size_t index_r = row + std::max<std::size_t>(start[0], 1); index_r < end_edge;
+                 index_r += solver_batch_size) {
+                const std::size_t count{std::min<std::size_t>(solver_batch_size, end_edge - index_r)};
+                const std::size_t index_l{index_r - 1};
+                max_wave_speed = std::max<real>(max_wave_speed,
+                                                 wave_speed_batch(count, x_edges, index_r + y,
+                                                                  lanes_at(h, index_l), lanes_at(hu, index_l),
+                                                                  lanes_at(h, index_r), lanes_at(hu, index_r)));
+            }
+        }
+        tile_wave_speeds[active_tiles[i]] = max_wave_speed;
+    }
+
+    // Every thread takes the maximum itself, which is cheaper than waiting for one of them
+    real max_wave_speed{0.F};
+    for (const auto &tile : wet_tiles) {
+        max_wave_speed = std::max<real>(max_wave_speed, tile_wave_speeds[tile]);
+    }
+    return max_wave_speed;
+}
+
+// Kernels of this variant, for every precision policy and both boundary conditions. Other layouts than the default one
+// are only compiled in single precision, which is enough to compare them.
+template void basic_simulation<single_precision>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<single_precision>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<double_precision>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<double_precision>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<bfloat16_storage>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<bfloat16_storage>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<single_precision, aosoa16_layout>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<single_precision, aosoa16_layout>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<single_precision, morton8_layout>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<single_precision, morton8_layout>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+#ifdef __FLT16_MAX__
+template void basic_simulation<half_storage>::selectKernels<outflow_boundary, SWE_KERNEL_ISA>();
+template void basic_simulation<half_storage>::selectKernels<wall_boundary, SWE_KERNEL_ISA>();
+#endif
@@ -0,0 +1,401 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "allocator.h"
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Calls a function for every chunk of rows, in parallel with the static schedule the sweeps use. Cells filled this way
+ * are touched first by the thread computing them, which places their pages on that thread's NUMA node.
+ * @param row_chunks First row of each chunk, followed by the number of rows
+ * @param fill Function taking the first row of a chunk and one past its last row
+ */
+template <typename function>
+void for_row_chunks(const std::vector<std::size_t>& row_chunks, const function& fill) {
+#pragma omp parallel for schedule(static) default(none) shared(row_chunks, fill)
+  for (std::size_t chunk = 0; chunk < row_chunks.size() - 1; ++chunk) {
+    fill(row_chunks[chunk], row_chunks[chunk + 1]);
+  }
+}
+
+/**
+ * Lanes of a batch of cells, for quantities stored as plain arrays
+ * @param quantity First value of the quantity
+ * @param first First cell of the batch
+ * @return Pointer to the first cell, lane i is cell first + i
+ */
+template <typename value>
+constexpr value* lanes_at(value* quantity, const std::size_t& first) {
+  return quantity + first;
+}
+
+/**
+ * Every quantity in an array of its own. Views of the quantities are plain pointers, so the batch solvers get
+ * contiguous lanes.
+ */
+struct soa_layout {
+  /**
+   * Bathymetry, heights and momenta of all cells
+   * @tparam real Type of bathymetry and heights
+   * @tparam storage Type of the momenta
+   */
+  template <typename real, typename storage>
+  class cells {
+    grid_vector<real> b_values;
+    grid_vector<real> h_values;
+    grid_vector<storage> hu_values;
+    grid_vector<storage> hv_values;
+
+  public:
+    using b_view = real*;
+    using h_view = real*;
+    using hu_view = storage*;
+    using hv_view = storage*;
+
+    cells() = default;
+
+    /**
+     * Allocates cells numbered row by row and lets a function fill them
+     * @param row_length Number of cells per row
+     * @param num_rows Number of rows
+     * @param row_chunks Chunks of rows of the sweeps, see for_row_chunks
+     * @param fill Function taking these cells, the first row of a chunk and one past its last row. Writes all cells of
+     * the rows through b, h, hu and hv.
+     */
+    template <typename function>
+    cells(const std::size_t& row_length, const std::size_t& num_rows, const std::vector<std::size_t>& row_chunks,
+          const function& fill)
+        : b_values(row_length * num_rows),
+          h_values(row_length * num_rows),
+          hu_values(row_length * num_rows),
+          hv_values(row_length * num_rows) {
+      for_row_chunks(row_chunks, [&](const std::size_t& first, const std::size_t& end) { fill(*this, first, end); });
+    }
+
+    [[nodiscard]] b_view b() { return b_values.data(); }
+    [[nodiscard]] h_view h() { return h_values.data(); }
+    [[nodiscard]] hu_view hu() { return hu_values.data(); }
+    [[nodiscard]] hv_view hv() { return hv_values.data(); }
+  };
+};
+
+/**
+ * Cells in blocks of one SIMD register width, each holding b, h, hu and hv of its cells one after another. A cell and
+ * its neighbours in y direction share fewer pages than with one array per quantity. Lanes of a batch may span two
+ * blocks, so the batch solvers gather them.
+ * @tparam width Number of cells per block
+ */
+template <std::size_t width>
+struct aosoa_layout {
+  /**
+   * Bathymetry, heights and momenta of all cells
+   * @tparam real Type of bathymetry and heights
+   * @tparam storage Type of the momenta
+   */
+  template <typename real, typename storage>
+  class cells {
+    /** Quantities of width cells */
+    struct block {
+      real b[width];
+      real h[width];
+      storage hu[width];
+      storage hv[width];
+    };
+
+    grid_vector<block> blocks;
+
+  public:
+    /**
+     * One quantity of all cells
+     * @tparam value Type of the quantity
+     * @tparam quantity Array of the quantity within a block
+     */
+    template <typename value, value (block::*quantity)[width]>
+    class view {
+      block* first_block{nullptr};
+
+    public:
+      /** Lanes of a batch of cells */
+      struct lanes {
+        block* first_block;
+        std::size_t first;
+
+        value& operator[](const std::size_t& lane) const {
+          return (first_block[(first + lane) / width].*quantity)[(first + lane) % width];
+        }
+      };
+
+      view() = default;
+      explicit view(block* first_block) : first_block{first_block} {}
+
+      value& operator[](const std::size_t& cell) const { return (first_block[cell / width].*quantity)[cell % width]; }
+
+      /**
+       * Lanes of a batch of cells
+       * @param cells Quantity
+       * @param first First cell of the batch
+       * @return Lanes, lane i is cell first + i
+       */
+      friend lanes lanes_at(const view& cells, const std::size_t& first) { return {cells.first_block, first}; }
+    };
+
+    using b_view = view<real, &block::b>;
+    using h_view = view<real, &block::h>;
+    using hu_view = view<storage, &block::hu>;
+    using hv_view = view<storage, &block::hv>;
+
+    cells() = default;
+
+    /**
+     * Allocates blocks for cells numbered row by row and lets a function fill them
+     * @param row_length Number of cells per row
+     * @param num_rows Number of rows
+     * @param row_chunks Chunks of rows of the sweeps, see for_row_chunks
+     * @param fill Function taking these cells, the first row of a chunk and one past its last row. Writes all cells of
+     * the rows through b, h, hu and hv.
+     */
+    template <typename function>
+    cells(const std::size_t& row_length, const std::size_t& num_rows, const std::vector<std::size_t>& row_chunks,
+          const function& fill)
+        : blocks((row_length * num_rows + width - 1) / width) {
+      for_row_chunks(row_chunks, [&](const std::size_t& first, const std::size_t& end) { fill(*this, first, end); });
+
+      // Lanes of the last block past the last cell
+      for (std::size_t cell{row_length * num_rows}; cell < blocks.size() * width; ++cell) {
+        blocks[cell / width].b[cell % width] = real{};
+        blocks[cell / width].h[cell % width] = real{};
+        blocks[cell / width].hu[cell % width] = storage{};
+        blocks[cell / width].hv[cell % width] = storage{};
+      }
+    }
+
+    [[nodiscard]] b_view b() { return b_view{blocks.data()}; }
+    [[nodiscard]] h_view h() { return h_view{blocks.data()}; }
+    [[nodiscard]] hu_view hu() { return hu_view{blocks.data()}; }
+    [[nodiscard]] hv_view hv() { return hv_view{blocks.data()}; }
+  };
+};
+
+/** Blocks of 16 cells, one AVX-512 register of floats */
+using aosoa16_layout = aosoa_layout<16>;
+
+/**
+ * Every quantity in an array of its own, split into square tiles. Tiles are stored row by row, the cells of a tile in
+ * Z-order (Morton order), so neighbours in both directions mostly lie within the same few cache lines. Kernels keep
+ * numbering cells row by row, views map these numbers to positions within the arrays.
+ * @tparam tile Number of cells per tile in x and y direction, a power of two
+ */
+template <std::size_t tile>
+struct morton_layout {
+  static_assert(tile > 0 && (tile & (tile - 1)) == 0, "Tiles must have a power of two side length");
+
+  /**
+   * Spreads the bits of a coordinate within a tile, so the bits of x and y can be interleaved
+   * @param coordinate Coordinate within a tile
+   * @return Bit i of coordinate at bit 2 * i
+   */
+  static constexpr std::size_t spread(const std::size_t& coordinate) {
+    std::size_t bits{0};
+    for (std::size_t bit{0}; (std::size_t{1} << bit) < tile; ++bit) {
+      bits |= (coordinate >> bit & 1U) << (2 * bit);
+    }
+    return bits;
+  }
+
+  /**
+   * Part of the position of a cell given by its column
+   * @param x Column of the cell
+   * @return Offset of the tile within its row of tiles plus the x bits of the Z-order within the tile
+   */
+  static constexpr std::size_t column_part(const std::size_t& x) {
+    return x / tile * tile * tile + spread(x % tile);
+  }
+
+  /** Maps cells numbered row by row to positions within the arrays */
+  class mapping {
+    std::size_t row_length{0};
+
+    /** 1 / row_length, to find the row of a cell without an integer division */
+    double inverse_row_length{0.};
+
+    /** Number of tiles in x direction */
+    std::size_t num_tiles_x{0};
+
+  public:
+    mapping() = default;
+
+    /** @param row_length Number of cells per row */
+    explicit mapping(const std::size_t& row_length)
+        : row_length{row_length},
+          inverse_row_length{1. / static_cast<double>(row_length)},
+          num_tiles_x{(row_length + tile - 1) / tile} {}
+
+    /**
+     * Row of a cell. The quotient is at least half a cell away from the next integer, which double precision resolves
+     * for up to 2^50 cells.
+     * @param cell Cell numbered row by row
+     * @return Row of the cell
+     */
+    [[nodiscard]] std::size_t row(const std::size_t& cell) const {
+      return static_cast<std::size_t>((static_cast<double>(cell) + .5) * inverse_row_length);
+    }
+
+    /**
+     * Column of a cell
+     * @param cell Cell numbered row by row
+     * @param y Row of the cell
+     * @return Column of the cell
+     */
+    [[nodiscard]] std::size_t column(const std::size_t& cell, const std::size_t& y) const {
+      return cell - y * row_length;
+    }
+
+    /**
+     * Part of the position of a cell given by its row
+     * @param y Row of the cell
+     * @return Offset of the row of tiles plus the y bits of the Z-order within the tile
+     */
+    [[nodiscard]] std::size_t row_part(const std::size_t& y) const {
+      return y / tile * num_tiles_x * tile * tile + (spread(y % tile) << 1U);
+    }
+
+    /**
+     * Position of a cell
+     * @param cell Cell numbered row by row
+     * @return Index within the arrays
+     */
+    [[nodiscard]] std::size_t operator()(const std::size_t& cell) const {
+      const std::size_t y{row(cell)};
+      return row_part(y) + column_part(column(cell, y));
+    }
+
+    /**
+     * Number of values per row, including the padding of partial tiles
+     * @return Number of cells per row rounded up to whole tiles
+     */
+    [[nodiscard]] std::size_t padded_row_length() const { return num_tiles_x * tile; }
+
+    /**
+     * Number of values per array, including the padding of partial tiles
+     * @param num_rows Number of rows
+     * @return Size of the arrays
+     */
+    [[nodiscard]] std::size_t size(const std::size_t& num_rows) const {
+      return num_tiles_x * ((num_rows + tile - 1) / tile) * tile * tile;
+    }
+  };
+
+  /**
+   * Bathymetry, heights and momenta of all cells
+   * @tparam real Type of bathymetry and heights
+   * @tparam storage Type of the momenta
+   */
+  template <typename real, typename storage>
+  class cells {
+    mapping positions;
+    grid_vector<real> b_values;
+    grid_vector<real> h_values;
+    grid_vector<storage> hu_values;
+    grid_vector<storage> hv_values;
+
+    /**
+     * Pads the end of a row of tiles with zeros
+     * @param y Row
+     * @param first_x First column to pad
+     */
+    void pad(const std::size_t& y, const std::size_t& first_x) {
+      for (std::size_t x{first_x}; x < positions.padded_row_length(); ++x) {
+        const std::size_t index{positions.row_part(y) + column_part(x)};
+        b_values[index] = real{};
+        h_values[index] = real{};
+        hu_values[index] = storage{};
+        hv_values[index] = storage{};
+      }
+    }
+
+  public:
+    /**
+     * One quantity of all cells
+     * @tparam value Type of the quantity
+     */
+    template <typename value>
+    class view {
+      value* values{nullptr};
+      mapping positions;
+
+    public:
+      /** Lanes of a batch of cells. Batches lie within one row, so the row part of the position is found once. */
+      struct lanes {
+        value* values;
+        std::size_t row_part;
+        std::size_t first_x;
+
+        value& operator[](const std::size_t& lane) const { return values[row_part + column_part(first_x + lane)]; }
+      };
+
+      view() = default;
+      view(value* values, const mapping& positions) : values{values}, positions{positions} {}
+
+      value& operator[](const std::size_t& cell) const { return values[positions(cell)]; }
+
+      /**
+       * Lanes of a batch of cells
+       * @param cells Quantity
+       * @param first First cell of the batch, all cells of the batch lie in its row
+       * @return Lanes, lane i is cell first + i
+       */
+      friend lanes lanes_at(const view& cells, const std::size_t& first) {
+        const std::size_t y{cells.positions.row(first)};
+        return {cells.values, cells.positions.row_part(y), cells.positions.column(first, y)};
+      }
+    };
+
+    using b_view = view<real>;
+    using h_view = view<real>;
+    using hu_view = view<storage>;
+    using hv_view = view<storage>;
+
+    cells() = default;
+
+    /**
+     * Allocates tiles for cells numbered row by row and lets a function fill them, padding partial tiles with zeros
+     * @param row_length Number of cells per row
+     * @param num_rows Number of rows
+     * @param row_chunks Chunks of rows of the sweeps, see for_row_chunks
+     * @param fill Function taking these cells, the first row of a chunk and one past its last row. Writes all cells of
+     * the rows through b, h, hu and hv.
+     */
+    template <typename function>
+    cells(const std::size_t& row_length, const std::size_t& num_rows, const std::vector<std::size_t>& row_chunks,
+          const function& fill)
+        : positions{row_length},
+          b_values(positions.size(num_rows)),
+          h_values(positions.size(num_rows)),
+          hu_values(positions.size(num_rows)),
+          hv_values(positions.size(num_rows)) {
+      for_row_chunks(row_chunks, [&](const std::size_t& first, const std::size_t& end) {
+        fill(*this, first, end);
+        for (std::size_t y{first}; y < end; ++y) {
+          pad(y, row_length);
+        }
+      });
+
+      // Rows of the last row of tiles past the last row
+      for (std::size_t y{num_rows}; y % tile != 0; ++y) {
+        pad(y, 0);
+      }
+    }
+
+    [[nodiscard]] b_view b() { return {b_values.data(), positions}; }
+    [[nodiscard]] h_view h() { return {h_values.data(), positions}; }
+    [[nodiscard]] hu_view hu() { return {hu_values.data(), positions}; }
+    [[nodiscard]] hv_view hv() { return {hv_values.data(), positions}; }
+  };
+};
+
+/** Tiles of 8 x 8 cells */
+using morton8_layout = morton_layout<8>;
+
+#endif  // LAYOUT_H
@@ -19,6 +19,9 @@ int main(int argc, char *argv[]) {
     refBuilder->get_widget_derived("main_window", gui);
 
     app->run(*gui);
+
+    // toplevel windows of a builder belong to the caller, deleting it joins a running simulation
+    delete gui;
   return 0;
 }
 
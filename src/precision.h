@@ -0,0 +1,69 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Brain floating point number: the upper half of a float. Only used for storage, all arithmetic converts to float.
+ * Conversions are plain integer operations, so loops over these vectorize.
+ */
+struct bfloat16 {
+  /** Sign, exponent and upper 7 bits of the mantissa of a float */
+  std::uint16_t bits;
+
+  bfloat16() = default;
+
+  /**
+   * Rounds a float to the nearest bfloat16, ties to even
+   * @param value Float to round
+   */
+  bfloat16(const float& value) {
+    std::uint32_t word{0};
+    std::memcpy(&word, &value, sizeof(word));
+    bits = static_cast<std::uint16_t>((word + 0x7FFFU + ((word >> 16U) & 1U)) >> 16U);
+  }
+
+  /**
+   * Widens to a float, which is exact
+   * @return Float with the same value
+   */
+  operator float() const {
+    const std::uint32_t word{static_cast<std::uint32_t>(bits) << 16U};
+    float value{0.F};
+    std::memcpy(&value, &word, sizeof(value));
+    return value;
+  }
+};
+
+/**
+ * Precision of a simulation. Heights, bathymetry and all arithmetic use the compute type, the momenta hu and hv are
+ * stored in the storage type. Heights stay in the compute type, because the small changes of a timestep would be lost
+ * when rounding them to a short type.
+ * @tparam compute_type Type of heights, bathymetry and arithmetic
+ * @tparam storage_type Type of the stored momenta
+ */
+template <typename compute_type, typename storage_type>
+struct precision_policy {
+  using compute = compute_type;
+  using storage = storage_type;
+};
+
+/** Everything in float */
+using single_precision = precision_policy<float, float>;
+
+/** Everything in double, for validation runs */
+using double_precision = precision_policy<double, double>;
+
+/**
+ * Momenta stored as bfloat16, float arithmetic. Halves the memory traffic of the momenta on large grids, but keeps only
+ * about three significant digits of them, which moves steep wave fronts noticeably.
+ */
+using bfloat16_storage = precision_policy<float, bfloat16>;
+
+#ifdef __FLT16_MAX__
+/** Momenta stored as IEEE half precision numbers, float arithmetic. Only where the compiler supports _Float16. */
+using half_storage = precision_policy<float, _Float16>;
+#endif
+
+#endif  // PRECISION_H
@@ -0,0 +1,195 @@
+#include "pyramid.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+/** Identifies cache files of this format */
+static constexpr std::array<char, 8> pyramid_magic{'S', 'W', 'E', 'P', 'Y', 'R', '1', '\0'};
+
+/** Start of a cache file */
+struct pyramid_header {
+    std::array<char, 8> magic;
+
+    /** Key of the bathymetry file */
+    std::uint64_t key;
+
+    /** Number of levels */
+    std::uint64_t num_levels;
+
+    /** Grid of the bathymetry file */
+    std::array<std::uint64_t, 2> num;
+    std::array<float, 2> size;
+    std::array<float, 2> origin;
+};
+
+/** Follows the header once per level */
+struct pyramid_level_header {
+    std::array<std::uint64_t, 2> num;
+    std::array<float, 2> size;
+    std::array<float, 2> origin;
+
+    /** Position of the values within the file in bytes */
+    std::uint64_t offset;
+};
+
+/**
+ * Averages 2 x 2 cells of a level. Cells on the upper borders of odd sized levels average the cells that exist.
+ * @param fine Level to average
+ * @return Values of the next coarser level
+ */
+static std::vector<float> coarsen(const bathymetry_pyramid::level &fine) {
+    const std::array<std::size_t, 2> num{(fine.num[0] + 1) / 2, (fine.num[1] + 1) / 2};
+    std::vector<float> coarse(num[0] * num[1]);
+#pragma omp parallel for schedule(static) default(none) shared(fine, num, coarse)
+    for (std::size_t j = 0; j < num[1]; ++j) {
+        for (std::size_t i{0}; i < num[0]; ++i) {
+            float sum{0.F};
+            float count{0.F};
+            for (std::size_t y{2 * j}; y < std::min(2 * j + 2, fine.num[1]); ++y) {
+                for (std::size_t x{2 * i}; x < std::min(2 * i + 2, fine.num[0]); ++x) {
+                    sum += fine.values[y * fine.num[0] + x];
+                    count += 1.F;
+                }
+            }
+            coarse[j * num[0] + i] = sum / count;
+        }
+    }
+    return coarse;
+}
+
+/**
+ * Grid of the next coarser level
+ * @param fine Level to average
+ * @return Grid of the next coarser level, without values
+ */
+static bathymetry_pyramid::level coarserGrid(const bathymetry_pyramid::level &fine) {
+    return {{(fine.num[0] + 1) / 2, (fine.num[1] + 1) / 2},
+            {fine.size[0] * 2.F, fine.size[1] * 2.F},
+            fine.origin,
+            nullptr};
+}
+
+bathymetry_pyramid::bathymetry_pyramid(mapped_file file) : file{std::move(file)} {}
+
+std::optional<bathymetry_pyramid> bathymetry_pyramid::map(const std::string &path,
+                                                          const std::uint64_t &key,
+                                                          const level &source) {
+    std::optional<mapped_file> file{mapped_file::open(path, sizeof(pyramid_header))};
+    if (!file) { return std::nullopt; }
+    bathymetry_pyramid pyramid{std::move(*file)};
+    const char *bytes{pyramid.file.data()};
+    const std::size_t length{pyramid.file.size()};
+
+    // The file must belong to this bathymetry and hold all levels it announces
+    pyramid_header header{};
+    std::memcpy(&header, bytes, sizeof(header));
+    if (header.magic != pyramid_magic || header.key != key || header.num[0] != source.num[0] ||
+        header.num[1] != source.num[1] || header.size != source.size || header.origin != source.origin ||
+        header.num_levels > (length - sizeof(header)) / sizeof(pyramid_level_header)) {
+        return std::nullopt;
+    }
+    for (std::size_t i{0}; i < header.num_levels; ++i) {
+        pyramid_level_header level_header{};
+        std::memcpy(&level_header, bytes + sizeof(header) + i * sizeof(level_header), sizeof(level_header));
+        const std::size_t level_bytes{level_header.num[0] * level_header.num[1] * sizeof(float)};
+        if (level_header.offset % cache_alignment != 0 || level_header.offset > length ||
+            level_bytes > length - level_header.offset) {
+            return std::nullopt;
+        }
+        pyramid.levels.push_back({{level_header.num[0], level_header.num[1]},
+                                  level_header.size,
+                                  level_header.origin,
+                                  reinterpret_cast<const float *>(bytes + level_header.offset)});
+    }
+    return pyramid;
+}
+
+bool bathymetry_pyramid::build(const std::string &path, const std::uint64_t &key, const level &source) {
+    // Levels until one gets too small
+    std::vector<pyramid_level_header> level_headers;
+    for (level coarse{coarserGrid(source)}; coarse.num[0] >= min_level_cells && coarse.num[1] >= min_level_cells;
+         coarse = coarserGrid(coarse)) {
+        level_headers.push_back({{coarse.num[0], coarse.num[1]}, coarse.size, coarse.origin, 0});
+    }
+
+    // Header, level headers, then the values of each level
+    const pyramid_header header{pyramid_magic,
+                                key,
+                                level_headers.size(),
+                                {source.num[0], source.num[1]},
+                                source.size,
+                                source.origin};
+    std::uint64_t offset{sizeof(header) + level_headers.size() * sizeof(pyramid_level_header)};
+    for (std::size_t i{0}; i < level_headers.size(); ++i) {
+        offset = (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+        level_headers[i].offset = offset;
+        offset += level_headers[i].num[0] * level_headers[i].num[1] * sizeof(float);
+    }
+
+    return write_cache_file(path, [&](std::ofstream &file) {
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(level_headers.data()),
+                   static_cast<std::streamsize>(level_headers.size() * sizeof(pyramid_level_header)));
+
+        // Each level is averaged from the one below right before it is written
+        std::vector<float> values;
+        level finer{source};
+        for (const auto &level_header : level_headers) {
+            values = coarsen(finer);
+            finer = {{level_header.num[0], level_header.num[1]}, level_header.size, level_header.origin, values.data()};
+            pad_cache_file(file);
+            file.write(reinterpret_cast<const char *>(values.data()),
+                       static_cast<std::streamsize>(values.size() * sizeof(float)));
+        }
+    });
+}
+
+std::optional<bathymetry_pyramid> bathymetry_pyramid::open(const std::string &bathy_name, const level &source) {
+    const std::optional<std::uint64_t> key{file_key(bathy_name)};
+    if (!key) { return std::nullopt; }
+    return map(cache_path(*key, "pyramid"), *key, source);
+}
+
+std::optional<bathymetry_pyramid> bathymetry_pyramid::store(const std::string &bathy_name, const level &source) {
+    const std::optional<std::uint64_t> key{file_key(bathy_name)};
+    if (!key) { return std::nullopt; }
+    const std::string path{cache_path(*key, "pyramid")};
+    if (!build(path, *key, source)) { return std::nullopt; }
+    return map(path, *key, source);
+}
+
+std::size_t bathymetry_pyramid::depth(const level &source, const std::array<float, 2> &cell_size) {
+    // Same levels as build, cells only grow with the depth
+    std::size_t depth{0};
+    for (level coarse{coarserGrid(source)}; coarse.num[0] >= min_level_cells && coarse.num[1] >= min_level_cells &&
+                                            coarse.size[0] <= cell_size[0] && coarse.size[1] <= cell_size[1];
+         coarse = coarserGrid(coarse)) {
+        ++depth;
+    }
+    return depth;
+}
+
+auto bathymetry_pyramid::grid(const level &source, const std::size_t &depth) -> level {
+    level coarse{source.num, source.size, source.origin, nullptr};
+    for (std::size_t i{0}; i < depth; ++i) {
+        coarse = coarserGrid(coarse);
+    }
+    return coarse;
+}
+
+std::vector<float> bathymetry_pyramid::average(const level &part, const std::size_t &depth) {
+    // Parts start at a multiple of 2^depth cells, so their 2 x 2 cells are those of the file on every level
+    std::vector<float> values(part.values, part.values + part.num[0] * part.num[1]);
+    level finer{part};
+    for (std::size_t i{0}; i < depth; ++i) {
+        values = coarsen(finer);
+        finer = coarserGrid(finer);
+        finer.values = values.data();
+    }
+    return values;
+}
+
+auto bathymetry_pyramid::get_level(const std::size_t &depth) const -> const level * {
+    return depth == 0 || depth > levels.size() ? nullptr : &levels[depth - 1];
+}
@@ -0,0 +1,122 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "cache.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Coarser levels of a bathymetry, each averaging 2 x 2 cells of the level below over their area. Built once per
+ * bathymetry file whenever the whole file was read anyway, cached on disk and mapped into memory, so coarse
+ * simulations sample a level about their own resolution instead of the full file. Bathymetries without a cached
+ * pyramid are averaged the same way with average, so results don't depend on the cache.
+ */
+class bathymetry_pyramid {
+public:
+  /** One level, cells numbered row by row */
+  struct level {
+    /** Number of cells in x and y direction */
+    std::array<std::size_t, 2> num;
+
+    /** Size of cells in x and y direction */
+    std::array<float, 2> size;
+
+    /** Origin (bottom left corner) position */
+    std::array<float, 2> origin;
+
+    /** Values of all cells, within the mapped cache file */
+    const float* values;
+  };
+
+private:
+  /** Mapped cache file */
+  mapped_file file;
+
+  /** Levels from the finest, half the resolution of the file, to the coarsest */
+  std::vector<level> levels;
+
+  /**
+   * Constructor
+   * @param file Mapped cache file
+   */
+  explicit bathymetry_pyramid(mapped_file file);
+
+  /**
+   * Maps a cache file and finds its levels
+   * @param path Cache file
+   * @param key Key of the bathymetry file
+   * @param source Grid of the bathymetry file, values are not used
+   * @return Pyramid, or nothing if the file is missing or doesn't belong to the bathymetry file
+   */
+  static std::optional<bathymetry_pyramid> map(const std::string& path, const std::uint64_t& key, const level& source);
+
+  /**
+   * Averages levels and writes them to a cache file. Only the level being written and the one below are held in
+   * memory.
+   * @param path Cache file
+   * @param key Key of the bathymetry file
+   * @param source Grid and values of the bathymetry file
+   * @return Whether the file could be written
+   */
+  static bool build(const std::string& path, const std::uint64_t& key, const level& source);
+
+public:
+  /** Levels stop once they are this small in a direction */
+  static constexpr std::size_t min_level_cells{16};
+
+  /**
+   * Maps the cached pyramid of a bathymetry file. Cache files are keyed by the file_key of the bathymetry file.
+   * @param bathy_name Name of bathymetry file
+   * @param source Grid of the bathymetry file, values are not used
+   * @return Pyramid, or nothing if it isn't cached
+   */
+  static std::optional<bathymetry_pyramid> open(const std::string& bathy_name, const level& source);
+
+  /**
+   * Builds the pyramid of a bathymetry file, caches it and maps it
+   * @param bathy_name Name of bathymetry file
+   * @param source Grid and all values of the bathymetry file
+   * @return Pyramid, or nothing if no cache file could be written
+   */
+  static std::optional<bathymetry_pyramid> store(const std::string& bathy_name, const level& source);
+
+  /**
+   * Depth of the coarsest level whose cells are no larger than the given ones
+   * @param source Grid of the bathymetry file, values are not used
+   * @param cell_size Size of the cells the bathymetry will be sampled with
+   * @return Number of times the file is halved for the level, 0 if even the finest level is too coarse
+   */
+  static std::size_t depth(const level& source, const std::array<float, 2>& cell_size);
+
+  /**
+   * Grid of a level, whether the pyramid is cached or not
+   * @param source Grid of the bathymetry file, values are not used
+   * @param depth Depth of the level
+   * @return Grid of the level, without values
+   */
+  static level grid(const level& source, const std::size_t& depth);
+
+  /**
+   * Averages part of a bathymetry file like the levels of its pyramid, for files whose pyramid isn't cached. Cells of
+   * the part are exactly the cells of the level covering it.
+   * @param part Grid and values of the part, from a multiple of 2^depth cells of the file up to such a multiple or
+   * the end of the file
+   * @param depth Depth of the level
+   * @return Values of the part at the level, row by row
+   */
+  static std::vector<float> average(const level& part, const std::size_t& depth);
+
+  /**
+   * Getter for a level
+   * @param depth Depth of the level, see depth
+   * @return Level, or nullptr for depth 0
+   */
+  [[nodiscard]] const level* get_level(const std::size_t& depth) const;
+};
+
+#endif  // PYRAMID_H
@@ -1,51 +1,375 @@
 #include "scenario.h"
+#include "pyramid.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <netcdf>
+#include <omp.h>
+#include <stdexcept>
 #include <vector>
 
-file_scenario file_scenario::create(const std::string &bathy_name, const std::string &displ_name) {
-    // Open bathymetry file
-    netCDF::NcFile file{bathy_name, netCDF::NcFile::read};
+/**
+ * Centers of some cells of a row or column
+ * @param origin Position of the first cell's border
+ * @param cell_size Size of the cells
+ * @param cells First cell and one past the last cell
+ * @return Position of each cell's center
+ */
+static std::vector<float> cellCenters(const float &origin,
+                                      const float &cell_size,
+                                      const std::array<std::size_t, 2> &cells) {
+    std::vector<float> centers(cells[1] - cells[0]);
+    for (std::size_t i{cells[0]}; i < cells[1]; ++i) {
+        centers[i - cells[0]] = origin + (static_cast<float>(i) + .5F) * cell_size;
+    }
+    return centers;
+}
+
+/** sample_grid samples blocks of this many rows, so scenarios hoist their column tables out of many rows */
+static constexpr std::size_t sample_block_rows{64};
+
+void scenario::sample_grid(const std::array<float, 2> &origin,
+                           const std::array<float, 2> &cell_size,
+                           const std::array<std::size_t, 2> &num_cells,
+                           float *b_out,
+                           float *h_out) const {
+    // Scenarios may throw, which must not leave the parallel region
+    std::exception_ptr error;
+#pragma omp parallel for schedule(static) default(none) shared(origin, cell_size, num_cells, b_out, h_out, error)
+    for (std::size_t first = 0; first < num_cells[1]; first += sample_block_rows) {
+        try {
+            sample_rows(origin, cell_size, num_cells, {first, std::min(first + sample_block_rows, num_cells[1])},
+                        b_out + first * num_cells[0], h_out + first * num_cells[0]);
+        } catch (...) {
+#pragma omp critical
+            error = std::current_exception();
+        }
+    }
+    if (error) { std::rethrow_exception(error); }
+}
+
+void scenario::sample_rows(const std::array<float, 2> &origin,
+                           const std::array<float, 2> &cell_size,
+                           const std::array<std::size_t, 2> &num_cells,
+                           const std::array<std::size_t, 2> &rows,
+                           float *b_out,
+                           float *h_out) const {
+    const std::vector<float> x{cellCenters(origin[0], cell_size[0], {0, num_cells[0]})};
+    const std::vector<float> y{cellCenters(origin[1], cell_size[1], rows)};
+    for (std::size_t j{0}; j < y.size(); ++j) {
+        for (std::size_t i{0}; i < num_cells[0]; ++i) {
+            b_out[j * num_cells[0] + i] = get_bathymetry(x[i], y[j]);
+            h_out[j * num_cells[0] + i] = b_out[j * num_cells[0] + i] >= 0.F ? 0.F : get_height(x[i], y[j]);
+        }
+    }
+}
+
+/** Regular grid of cells of a bathymetry or displacement file */
+struct file_grid {
+    /** Number of cells in x and y direction */
+    std::array<std::size_t, 2> num;
+
+    /** Size of cells in x and y direction */
+    std::array<float, 2> size;
+
+    /** Origin (bottom left corner) position */
+    std::array<float, 2> origin;
+};
+
+/** Serializes calls into the NetCDF library, which isn't thread safe */
+static std::mutex netcdf_lock;
+
+/**
+ * Opens a bathymetry or displacement file
+ * @param file File object to open
+ * @param name Name of the file
+ * @param what Kind of the file, for error messages
+ */
+static void openFile(netCDF::NcFile &file, const std::string &name, const std::string &what) {
+    try {
+        file.open(name, netCDF::NcFile::read);
+    } catch (...) {
+        throw std::runtime_error(what + " file is not valid!");
+    }
+    if (file.isNull()) { throw std::runtime_error(what + " file is not valid!"); }
+}
+
+/**
+ * Reads the grid of a file and checks it. The file needs dimensions x and y of at least 2 cells each, coordinate
+ * variables x and y that are strictly increasing and a variable z(y, x). Grids are regular, so the cell size comes
+ * from the first two coordinates in each direction.
+ * @param file Bathymetry or displacement file
+ * @param what Kind of the file, for error messages
+ * @return Grid of the whole file
+ */
+static file_grid readGrid(const netCDF::NcFile &file, const std::string &what) {
+    const netCDF::NcDim dim_x{file.getDim("x")};
+    const netCDF::NcDim dim_y{file.getDim("y")};
+    const netCDF::NcVar var_x{file.getVar("x")};
+    const netCDF::NcVar var_y{file.getVar("y")};
+    const netCDF::NcVar var_z{file.getVar("z")};
+    if (dim_x.isNull() || dim_y.isNull() || var_x.isNull() || var_y.isNull() || var_z.isNull() ||
+        var_z.getDimCount() != 2 || dim_x.getSize() < 2 || dim_y.getSize() < 2) {
+        throw std::runtime_error(what + " file is not valid!");
+    }
+
+    // Coordinates must be strictly increasing
+    std::vector<float> x(dim_x.getSize());
+    std::vector<float> y(dim_y.getSize());
+    var_x.getVar(x.data());
+    var_y.getVar(y.data());
+    if (std::adjacent_find(x.begin(), x.end(), std::greater_equal<>{}) != x.end() ||
+        std::adjacent_find(y.begin(), y.end(), std::greater_equal<>{}) != y.end()) {
+        throw std::runtime_error(what + " file is not valid!");
+    }
+
+    const std::array<std::size_t, 2> num{x.size(), y.size()};
+    const std::array<float, 2> size{x[1] - x[0], y[1] - y[0]};
+    return {num, size, {x[0] - .5F * size[0], y[0] - .5F * size[1]}};
+}
+
+/**
+ * Cells of a grid overlapping a rectangle plus a margin, clamped to the grid
+ * @param grid Grid of a file
+ * @param lower Bottom left corner of the rectangle
+ * @param upper Top right corner of the rectangle
+ * @param margin Number of cells added on each side
+ * @return First cell and one past the last cell in x and y direction
+ */
+static std::array<std::array<std::size_t, 2>, 2> cellsCovering(const file_grid &grid,
+                                                               const std::array<float, 2> &lower,
+                                                               const std::array<float, 2> &upper,
+                                                               const std::size_t &margin) {
+    std::array<std::array<std::size_t, 2>, 2> cells{};
+    for (std::size_t dim{0}; dim < 2; ++dim) {
+        const float first{std::floor((lower[dim] - grid.origin[dim]) / grid.size[dim]) - static_cast<float>(margin)};
+        const float end{std::ceil((upper[dim] - grid.origin[dim]) / grid.size[dim]) + static_cast<float>(margin)};
+        const auto num{static_cast<float>(grid.num[dim])};
+        cells[0][dim] = static_cast<std::size_t>(std::clamp(first, 0.F, num));
+        cells[1][dim] = std::max(static_cast<std::size_t>(std::clamp(end, 0.F, num)), cells[0][dim]);
+    }
+    return cells;
+}
+
+/**
+ * Widens a hyperslab to whole chunks of a chunked variable, a chunk is read and decompressed as a whole anyway
+ * @param var Variable z of a file
+ * @param grid Grid of the file
+ * @param cells First cell and one past the last cell in x and y direction
+ */
+static void alignToChunks(const netCDF::NcVar &var,
+                          const file_grid &grid,
+                          std::array<std::array<std::size_t, 2>, 2> &cells) {
+    netCDF::NcVar::ChunkMode mode{netCDF::NcVar::nc_CONTIGUOUS};
+    std::vector<std::size_t> chunk_sizes;
+    {
+        const std::lock_guard<std::mutex> guard{netcdf_lock};
+        var.getChunkingParameters(mode, chunk_sizes);
+    }
+    if (mode != netCDF::NcVar::nc_CHUNKED || chunk_sizes.size() != 2) { return; }
+
+    // z is stored as z(y, x)
+    for (std::size_t dim{0}; dim < 2; ++dim) {
+        const std::size_t chunk{chunk_sizes[1 - dim]};
+        cells[0][dim] = cells[0][dim] / chunk * chunk;
+        cells[1][dim] = std::min((cells[1][dim] + chunk - 1) / chunk * chunk, grid.num[dim]);
+    }
+}
+
+/** Contiguous files are read in blocks of rows of about this many values */
+static constexpr std::size_t read_block_values{std::size_t{1} << 20U};
+
+/**
+ * Reads a hyperslab of a variable in blocks of rows, one chunk high for chunked files, and checks that all values are
+ * finite
+ * @param var Variable z of a file
+ * @param cells First cell and one past the last cell in x and y direction
+ * @param what Kind of the file, for error messages
+ * @param progress Called with the number of values read after each block
+ * @return Values of the cells, row by row
+ */
+static std::vector<float> readCells(const netCDF::NcVar &var,
+                                    const std::array<std::array<std::size_t, 2>, 2> &cells,
+                                    const std::string &what,
+                                    const std::function<void(const std::size_t &)> &progress) {
+    const std::array<std::size_t, 2> count{cells[1][0] - cells[0][0], cells[1][1] - cells[0][1]};
+    std::vector<float> values(count[0] * count[1]);
+    if (values.empty()) { return values; }
+
+    std::size_t block_rows{std::max<std::size_t>(read_block_values / count[0], 1)};
+    {
+        const std::lock_guard<std::mutex> guard{netcdf_lock};
+        netCDF::NcVar::ChunkMode mode{netCDF::NcVar::nc_CONTIGUOUS};
+        std::vector<std::size_t> chunk_sizes;
+        var.getChunkingParameters(mode, chunk_sizes);
+        if (mode == netCDF::NcVar::nc_CHUNKED && chunk_sizes.size() == 2) { block_rows = chunk_sizes[0]; }
+    }
+
+    // Rows of a block are checked while the next block is read by the other file's thread
+    for (std::size_t row{0}; row < count[1]; row += block_rows) {
+        const std::size_t rows{std::min(block_rows, count[1] - row)};
+        float *block{values.data() + row * count[0]};
+        {
+            const std::lock_guard<std::mutex> guard{netcdf_lock};
+            var.getVar({cells[0][1] + row, cells[0][0]}, {rows, count[0]}, block);
+        }
+        if (!std::all_of(block, block + rows * count[0], [](const float &value) { return std::isfinite(value); })) {
+            throw std::runtime_error(what + " file is not valid!");
+        }
+        progress(rows * count[0]);
+    }
+    return values;
+}
+
+/**
+ * Copies a hyperslab out of values in memory
+ * @param values Values of all cells, row by row
+ * @param row_length Number of cells per row
+ * @param cells First cell and one past the last cell in x and y direction
+ * @return Values of the cells, row by row
+ */
+static std::vector<float> copyCells(const float *values,
+                                    const std::size_t &row_length,
+                                    const std::array<std::array<std::size_t, 2>, 2> &cells) {
+    const std::size_t count_x{cells[1][0] - cells[0][0]};
+    std::vector<float> slab(count_x * (cells[1][1] - cells[0][1]));
+    for (std::size_t y{cells[0][1]}; y < cells[1][1]; ++y) {
+        std::copy_n(values + y * row_length + cells[0][0], count_x, slab.begin() + (y - cells[0][1]) * count_x);
+    }
+    return slab;
+}
+
+/**
+ * Grid of a hyperslab
+ * @param grid Grid of the whole file
+ * @param cells First cell and one past the last cell in x and y direction
+ * @return Grid of the cells
+ */
+static file_grid slabGrid(const file_grid &grid, const std::array<std::array<std::size_t, 2>, 2> &cells) {
+    return {{cells[1][0] - cells[0][0], cells[1][1] - cells[0][1]},
+            grid.size,
+            {grid.origin[0] + static_cast<float>(cells[0][0]) * grid.size[0],
+             grid.origin[1] + static_cast<float>(cells[0][1]) * grid.size[1]}};
+}
 
-    // Get number of cells in each dimension
-    const std::array<std::size_t, 2> num_b{file.getDim("x").getSize(), file.getDim("y").getSize()};
+file_scenario file_scenario::create(const std::string &bathy_name,
+                                    const std::string &displ_name,
+                                    const region &roi,
+                                    const std::array<std::size_t, 2> &num_cells,
+                                    const std::function<void(const float &)> &progress) {
+    // Open each file once and check its grid, values are only read once both hyperslabs are known
+    netCDF::NcFile bathy_file{};
+    netCDF::NcFile displ_file{};
+    openFile(bathy_file, bathy_name, "Bathymetry");
+    openFile(displ_file, displ_name, "Displacement");
+    const file_grid grid_b{readGrid(bathy_file, "Bathymetry")};
+    const file_grid grid_d{readGrid(displ_file, "Displacement")};
+    const std::array<float, 2> end_b{grid_b.origin[0] + grid_b.size[0] * grid_b.num[0],
+                                     grid_b.origin[1] + grid_b.size[1] * grid_b.num[1]};
+    if (grid_d.origin[0] < grid_b.origin[0] || grid_d.origin[0] + grid_d.size[0] * grid_d.num[0] > end_b[0] ||
+        grid_d.origin[1] < grid_b.origin[1] || grid_d.origin[1] + grid_d.size[1] * grid_d.num[1] > end_b[1]) {
+        throw std::runtime_error("Displacement outside of bathymetry!");
+    }
 
-    // Get values
-    std::vector<float> b(num_b[0] * num_b[1]);
-    file.getVar("z").getVar(b.data());
+    // Rectangle to load
+    std::array<float, 2> lower{grid_b.origin};
+    std::array<float, 2> upper{end_b};
+    if (!roi.whole()) {
+        lower = roi.origin;
+        upper = {roi.origin[0] + roi.size[0], roi.origin[1] + roi.size[1]};
+        if (lower[0] < grid_b.origin[0] || upper[0] > end_b[0] || lower[1] < grid_b.origin[1] || upper[1] > end_b[1]) {
+            throw std::runtime_error("Region of interest outside of bathymetry!");
+        }
+    }
 
-    // Get cell sizes in each direction
-    std::array<float, 4> tmp{};
-    file.getVar("x").getVar({0}, {2}, tmp.data());
-    file.getVar("y").getVar({0}, {2}, tmp.data() + 2);
-    const std::array<float, 2> size_b{tmp[1] - tmp[0], tmp[3] - tmp[2]};
+    // Displacement around the rectangle, then bathymetry around both, so the displacement stays inside
+    const netCDF::NcVar var_b{bathy_file.getVar("z")};
+    const netCDF::NcVar var_d{displ_file.getVar("z")};
+    auto cells_d{cellsCovering(grid_d, lower, upper, load_margin)};
+    alignToChunks(var_d, grid_d, cells_d);
+    file_grid slab_d{slabGrid(grid_d, cells_d)};
+    if (slab_d.num[0] == 0 || slab_d.num[1] == 0) {
+        slab_d = {{0, 0}, grid_d.size, lower};
+    } else {
+        for (std::size_t dim{0}; dim < 2; ++dim) {
+            lower[dim] = std::min(lower[dim], slab_d.origin[dim]);
+            upper[dim] = std::max(upper[dim], slab_d.origin[dim] + slab_d.size[dim] * slab_d.num[dim]);
+        }
+    }
+    auto cells_b{cellsCovering(grid_b, lower, upper, load_margin)};
+    alignToChunks(var_b, grid_b, cells_b);
+    file_grid slab_b{slabGrid(grid_b, cells_b)};
 
-    // Get origin location
-    const std::array<float, 2> orig_b{tmp[0] - .5F * size_b[0], tmp[2] - .5F * size_b[1]};
+    // Coarse samplings take the bathymetry from a level of its pyramid, cells of the file averaged over their area
+    const bathymetry_pyramid::level source{grid_b.num, grid_b.size, grid_b.origin, nullptr};
+    const region sampled{roi.whole() ? region{grid_b.origin, {end_b[0] - grid_b.origin[0], end_b[1] - grid_b.origin[1]}}
+                                     : roi};
+    const std::size_t depth{num_cells[0] > 0 && num_cells[1] > 0
+                                    ? bathymetry_pyramid::depth(source, {sampled.size[0] / num_cells[0],
+                                                                         sampled.size[1] / num_cells[1]})
+                                    : 0};
+    auto cells_f{cells_b};
+    if (depth > 0) {
+        const bathymetry_pyramid::level grid_l{bathymetry_pyramid::grid(source, depth)};
+        cells_b = cellsCovering({grid_l.num, grid_l.size, grid_l.origin}, lower, upper, load_margin);
+        slab_b = slabGrid({grid_l.num, grid_l.size, grid_l.origin}, cells_b);
 
-    // Open displacement file
-    file.open(displ_name, netCDF::NcFile::read);
+        // Cells of the file under those of the level
+        for (std::size_t dim{0}; dim < 2; ++dim) {
+            cells_f[0][dim] = cells_b[0][dim] << depth;
+            cells_f[1][dim] = std::min(cells_b[1][dim] << depth, grid_b.num[dim]);
+        }
+    }
 
-    // Get number of cells in each dimension
-    const std::array<std::size_t, 2> num_d{file.getDim("x").getSize(), file.getDim("y").getSize()};
+    // Part of the files the loaded bathymetry covers. Cells of a level may overhang the end of the file.
+    const region domain{slab_b.origin,
+                        {std::min(slab_b.origin[0] + slab_b.size[0] * slab_b.num[0], end_b[0]) - slab_b.origin[0],
+                         std::min(slab_b.origin[1] + slab_b.size[1] * slab_b.num[1], end_b[1]) - slab_b.origin[1]}};
 
-    // Get values
-    std::vector<float> d(num_d[0] * num_d[1]);
-    file.getVar("z").getVar(d.data());
+    // Progress counts the values of both hyperslabs at full resolution
+    const std::size_t total{(cells_f[1][0] - cells_f[0][0]) * (cells_f[1][1] - cells_f[0][1]) +
+                            slab_d.num[0] * slab_d.num[1]};
+    std::atomic<std::size_t> done{0};
+    const auto count{[&progress, &done, &total](const std::size_t &values) {
+        const std::size_t now{done += values};
+        if (progress) { progress(static_cast<float>(now) / static_cast<float>(std::max<std::size_t>(total, 1))); }
+    }};
 
-    // Get cell sizes in each direction
-    file.getVar("x").getVar({0}, {2}, tmp.data());
-    file.getVar("y").getVar({0}, {2}, tmp.data() + 2);
-    const std::array<float, 2> size_d{tmp[1] - tmp[0], tmp[3] - tmp[2]};
+    // The displacement is read next to the bathymetry
+    std::future<std::vector<float>> reading_d{std::async(std::launch::async, [&var_d, &cells_d, &count] {
+        return readCells(var_d, cells_d, "Displacement", count);
+    })};
 
-    // Get origin location
-    const std::array<float, 2> orig_d{tmp[0] - .5F * size_b[0], tmp[2] - .5F * size_b[1]};
+    // Levels are copied from the cached pyramid, or averaged from the file the same way
+    std::vector<float> b;
+    const std::optional<bathymetry_pyramid> pyramid{depth > 0 ? bathymetry_pyramid::open(bathy_name, source)
+                                                              : std::nullopt};
+    if (const bathymetry_pyramid::level *level{pyramid ? pyramid->get_level(depth) : nullptr}) {
+        count((cells_f[1][0] - cells_f[0][0]) * (cells_f[1][1] - cells_f[0][1]));
+        b = copyCells(level->values, level->num[0], cells_b);
+    } else {
+        b = readCells(var_b, cells_f, "Bathymetry", count);
+        if (depth > 0) {
+            // Loads of the whole file cache its pyramid for later coarse loads, loads of a region never read more
+            if (cells_f[0] == std::array<std::size_t, 2>{0, 0} && cells_f[1] == grid_b.num) {
+                bathymetry_pyramid::store(bathy_name, {grid_b.num, grid_b.size, grid_b.origin, b.data()});
+            }
+            const file_grid part{slabGrid(grid_b, cells_f)};
+            b = bathymetry_pyramid::average({part.num, part.size, part.origin, b.data()}, depth);
+        }
+    }
+    std::vector<float> d{reading_d.get()};
 
     // Create and return new scenario
-    return file_scenario{num_b, b, size_b, orig_b, num_d, d, size_d, orig_d};
+    return file_scenario{slab_b.num, b, slab_b.size, slab_b.origin, slab_d.num, d, slab_d.size, slab_d.origin, domain};
 }
 
 file_scenario::file_scenario(const std::array<std::size_t, 2> &num_b,
@@ -55,7 +379,8 @@ file_scenario::file_scenario(const std::array<std::size_t, 2> &num_b,
                              const std::array<std::size_t, 2> &num_d,
                              std::vector<float> &d,
                              const std::array<float, 2> &size_d,
-                             const std::array<float, 2> &orig_d)
+                             const std::array<float, 2> &orig_d,
+                             const region &domain)
         : num_b{num_b},
           b{std::move(b)},
           size_b{size_b},
@@ -63,7 +388,8 @@ file_scenario::file_scenario(const std::array<std::size_t, 2> &num_b,
           num_d{num_d},
           d{std::move(d)},
           size_d{size_d},
-          orig_d{orig_d} {
+          orig_d{orig_d},
+          domain{domain} {
     if (orig_d[0] < orig_b[0] || orig_d[0] + size_d[0] * num_d[0] > orig_b[0] + size_b[0] * num_b[0] ||
         orig_d[1] < orig_b[1] || orig_d[1] + size_d[1] * num_d[1] > orig_b[1] + size_b[1] * num_b[1]) {
         throw std::runtime_error("Displacement outside of bathymetry!");
@@ -79,9 +405,9 @@ std::size_t file_scenario::get_index(const float &x,
            static_cast<std::size_t>((x - origin[0]) / cell_size[0]);
 }
 
-std::array<float, 2> file_scenario::get_origin() const { return orig_b; }
+std::array<float, 2> file_scenario::get_origin() const { return domain.origin; }
 
-std::array<float, 2> file_scenario::get_size() const { return {num_b[0] * size_b[0], num_b[1] * size_b[1]}; }
+std::array<float, 2> file_scenario::get_size() const { return domain.size; }
 
 float file_scenario::get_bathymetry(const float &x, const float &y) const {
     if (x < orig_b[0] || x >= orig_b[0] + size_b[0] * num_b[0] || y < orig_b[1] ||
@@ -102,6 +428,296 @@ float file_scenario::get_height(const float &x, const float &y) const {
     return -std::min<float>(b.at(get_index(x, y, num_b[0], size_b, orig_b)), 0.F);
 }
 
+void file_scenario::sample_rows(const std::array<float, 2> &origin,
+                                const std::array<float, 2> &cell_size,
+                                const std::array<std::size_t, 2> &num_cells,
+                                const std::array<std::size_t, 2> &rows,
+                                float *b_out,
+                                float *h_out) const {
+    if (num_cells[0] == 0 || rows[1] <= rows[0]) { return; }
+    const std::vector<float> x{cellCenters(origin[0], cell_size[0], {0, num_cells[0]})};
+    const std::vector<float> y{cellCenters(origin[1], cell_size[1], rows)};
+
+    // Centers increase along both axes, so the outermost ones bound all of them
+    if (x.front() < orig_b[0] || x.back() >= orig_b[0] + size_b[0] * num_b[0] || y.front() < orig_b[1] ||
+        y.back() >= orig_b[1] + size_b[1] * num_b[1]) {
+        throw std::logic_error("Index outside scenario bounds!");
+    }
+
+    // Everything depending on the column only. Columns inside the displacement are contiguous for the same reason.
+    std::vector<std::size_t> column_b(num_cells[0]);
+    std::vector<std::size_t> column_d(num_cells[0], 0);
+    std::size_t first_d{num_cells[0]};
+    std::size_t end_d{num_cells[0]};
+    for (std::size_t i{0}; i < num_cells[0]; ++i) {
+        // Rounding can push a center just inside the last cell onto the next one
+        column_b[i] = std::min(static_cast<std::size_t>((x[i] - orig_b[0]) / size_b[0]), num_b[0] - 1);
+        if (x[i] >= orig_d[0] && x[i] < orig_d[0] + size_d[0] * num_d[0]) {
+            column_d[i] = std::min(static_cast<std::size_t>((x[i] - orig_d[0]) / size_d[0]), num_d[0] - 1);
+            first_d = std::min(first_d, i);
+            end_d = i + 1;
+        }
+    }
+
+    for (std::size_t j{0}; j < y.size(); ++j) {
+        const float *b_row{b.data() +
+                           std::min(static_cast<std::size_t>((y[j] - orig_b[1]) / size_b[1]), num_b[1] - 1) * num_b[0]};
+        float *b_cells{b_out + j * num_cells[0]};
+        float *h_cells{h_out + j * num_cells[0]};
+        for (std::size_t i = 0; i < num_cells[0]; ++i) {
+            b_cells[i] = b_row[column_b[i]];
+            h_cells[i] = -std::min<float>(b_row[column_b[i]], 0.F);
+        }
+
+        // Displacement only changes the bathymetry, heights come from the undisplaced sea floor
+        if (y[j] >= orig_d[1] && y[j] < orig_d[1] + size_d[1] * num_d[1]) {
+            const float *d_row{d.data() +
+                               std::min(static_cast<std::size_t>((y[j] - orig_d[1]) / size_d[1]), num_d[1] - 1) *
+                               num_d[0]};
+            for (std::size_t i = first_d; i < end_d; ++i) {
+                b_cells[i] += d_row[column_d[i]];
+            }
+        }
+
+        for (std::size_t i = 0; i < num_cells[0]; ++i) {
+            b_cells[i] = b_cells[i] < 0 ? std::min<float>(b_cells[i], -20.F) : std::max<float>(b_cells[i], 20.F);
+            h_cells[i] = b_cells[i] >= 0.F ? 0.F : h_cells[i];
+        }
+    }
+}
+
+/** Identifies cache files of sampled states */
+static constexpr std::array<char, 8> state_magic{'S', 'W', 'E', 'S', 'T', 'A', '3', '\0'};
+
+/** Grid of an input file within a cache file */
+struct grid_header {
+    std::array<std::uint64_t, 2> num;
+    std::array<float, 2> size;
+    std::array<float, 2> origin;
+};
+
+/** Start of a cache file of a sampled state, followed by the bathymetry and the water height of all cells */
+struct state_header {
+    std::array<char, 8> magic;
+
+    /** Key of the sampled state */
+    std::uint64_t key;
+
+    /** Grids of the bathymetry and the displacement file */
+    std::array<grid_header, 2> grids;
+
+    /** Grid the state was sampled on */
+    std::array<std::uint64_t, 2> num_cells;
+    std::array<float, 2> origin;
+    std::array<float, 2> size;
+
+    /** hash_bytes of the bathymetry and of the water height */
+    std::array<std::uint64_t, 2> checksums;
+};
+
+/**
+ * Position of the values of a sampled state within its cache file
+ * @param num_cells Number of cells in x and y direction
+ * @return Position of the bathymetry and the water height in bytes
+ */
+static std::array<std::size_t, 2> stateOffsets(const std::array<std::size_t, 2> &num_cells) {
+    const std::size_t bytes{num_cells[0] * num_cells[1] * sizeof(float)};
+    const std::size_t b_offset{(sizeof(state_header) + cache_alignment - 1) / cache_alignment * cache_alignment};
+    return {b_offset, b_offset + (bytes + cache_alignment - 1) / cache_alignment * cache_alignment};
+}
+
+/**
+ * Grids of a bathymetry and a displacement file as cache files record them
+ * @param bathy_name Name of bathymetry file
+ * @param displ_name Name of displacement file
+ * @return Grids, or nothing if a file is not valid
+ */
+static std::optional<std::array<grid_header, 2>> fileGrids(const std::string &bathy_name,
+                                                            const std::string &displ_name) {
+    try {
+        netCDF::NcFile bathy_file{};
+        netCDF::NcFile displ_file{};
+        openFile(bathy_file, bathy_name, "Bathymetry");
+        openFile(displ_file, displ_name, "Displacement");
+        const file_grid grid_b{readGrid(bathy_file, "Bathymetry")};
+        const file_grid grid_d{readGrid(displ_file, "Displacement")};
+        return std::array<grid_header, 2>{grid_header{{grid_b.num[0], grid_b.num[1]}, grid_b.size, grid_b.origin},
+                                          grid_header{{grid_d.num[0], grid_d.num[1]}, grid_d.size, grid_d.origin}};
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+}
+
+cached_scenario::cached_scenario(mapped_file file,
+                                 const std::array<std::size_t, 2> &num_cells,
+                                 const std::array<float, 2> &origin,
+                                 const std::array<float, 2> &size,
+                                 const std::size_t &b_offset,
+                                 const std::size_t &h_offset)
+        : file{std::move(file)},
+          num_cells{num_cells},
+          origin{origin},
+          size{size},
+          cell_size{size[0] / num_cells[0], size[1] / num_cells[1]},
+          b{reinterpret_cast<const float *>(this->file.data() + b_offset)},
+          h{reinterpret_cast<const float *>(this->file.data() + h_offset)} {}
+
+std::optional<std::uint64_t> cached_scenario::key(const std::string &bathy_name,
+                                                  const std::string &displ_name,
+                                                  const region &roi,
+                                                  const std::array<std::size_t, 2> &num_cells) {
+    const std::optional<std::uint64_t> bathy_key{file_key(bathy_name)};
+    const std::optional<std::uint64_t> displ_key{file_key(displ_name)};
+    if (!bathy_key || !displ_key) { return std::nullopt; }
+    std::uint64_t key{hash_bytes(hash_basis, state_magic.data(), state_magic.size())};
+    key = hash_bytes(key, &*bathy_key, sizeof(*bathy_key));
+    key = hash_bytes(key, &*displ_key, sizeof(*displ_key));
+    key = hash_bytes(key, roi.origin.data(), sizeof(roi.origin));
+    key = hash_bytes(key, roi.size.data(), sizeof(roi.size));
+    return hash_bytes(key, num_cells.data(), sizeof(num_cells));
+}
+
+std::optional<cached_scenario> cached_scenario::map(const std::string &path,
+                                                    const std::uint64_t &key,
+                                                    const std::string &bathy_name,
+                                                    const std::string &displ_name,
+                                                    const bool &check_values) {
+    std::optional<mapped_file> file{mapped_file::open(path, sizeof(state_header))};
+    if (!file) { return std::nullopt; }
+
+    // The file must belong to this key, hold both grids and match their checksum
+    state_header header{};
+    std::memcpy(&header, file->data(), sizeof(header));
+    const std::array<std::size_t, 2> num_cells{header.num_cells[0], header.num_cells[1]};
+    const std::size_t bytes{num_cells[0] * num_cells[1] * sizeof(float)};
+    const std::array<std::size_t, 2> offsets{stateOffsets(num_cells)};
+    if (header.magic != state_magic || header.key != key || num_cells[0] == 0 || num_cells[1] == 0 ||
+        offsets[1] + bytes > file->size()) {
+        return std::nullopt;
+    }
+
+    // Keys only sample the files, so the grids in their headers must still be the ones the state was sampled from
+    const std::optional<std::array<grid_header, 2>> grids{fileGrids(bathy_name, displ_name)};
+    if (!grids) { return std::nullopt; }
+    for (std::size_t i{0}; i < grids->size(); ++i) {
+        if ((*grids)[i].num != header.grids[i].num || (*grids)[i].size != header.grids[i].size ||
+            (*grids)[i].origin != header.grids[i].origin) {
+            return std::nullopt;
+        }
+    }
+    if (check_values && (hash_bytes(hash_basis, file->data() + offsets[0], bytes) != header.checksums[0] ||
+                         hash_bytes(hash_basis, file->data() + offsets[1], bytes) != header.checksums[1])) {
+        return std::nullopt;
+    }
+    return cached_scenario{std::move(*file), num_cells, header.origin, header.size, offsets[0], offsets[1]};
+}
+
+std::optional<cached_scenario> cached_scenario::open(const std::string &bathy_name,
+                                                     const std::string &displ_name,
+                                                     const region &roi,
+                                                     const std::array<std::size_t, 2> &num_cells) {
+    const std::optional<std::uint64_t> state_key{key(bathy_name, displ_name, roi, num_cells)};
+    if (!state_key) { return std::nullopt; }
+    return map(cache_path(*state_key, "state"), *state_key, bathy_name, displ_name, true);
+}
+
+std::optional<cached_scenario> cached_scenario::store(const scenario &scen,
+                                                      const std::string &bathy_name,
+                                                      const std::string &displ_name,
+                                                      const region &roi,
+                                                      const std::array<std::size_t, 2> &num_cells) {
+    const std::optional<std::uint64_t> state_key{key(bathy_name, displ_name, roi, num_cells)};
+    const std::optional<std::array<grid_header, 2>> grids{fileGrids(bathy_name, displ_name)};
+    if (!state_key || !grids || num_cells[0] == 0 || num_cells[1] == 0) { return std::nullopt; }
+
+    // Same grid as simulation::create derives from the scenario and the region of interest
+    const std::array<float, 2> origin{roi.whole() ? scen.get_origin() : roi.origin};
+    const std::array<float, 2> size{roi.whole() ? scen.get_size() : roi.size};
+    const std::array<float, 2> cell_size{size[0] / num_cells[0], size[1] / num_cells[1]};
+
+    // Rows are sampled in stripes of one block per thread, which are hashed and written right away, so the whole grid
+    // is never held in memory. Only the last stripe may end within a 64 bit word, so hashing stripe by stripe gives
+    // the hash of the whole grid.
+    const std::size_t stripe_rows{sample_block_rows * static_cast<std::size_t>(omp_get_max_threads())};
+    const std::size_t row_bytes{num_cells[0] * sizeof(float)};
+    const std::array<std::size_t, 2> offsets{stateOffsets(num_cells)};
+    std::vector<float> b(std::min(stripe_rows, num_cells[1]) * num_cells[0]);
+    std::vector<float> h(b.size());
+    state_header header{state_magic, *state_key, *grids, {num_cells[0], num_cells[1]}, origin, size,
+                        {hash_basis, hash_basis}};
+    std::exception_ptr error;
+    const std::string path{cache_path(*state_key, "state")};
+    const bool written{write_cache_file(path, [&](std::ofstream &file) {
+        for (std::size_t first = 0; first < num_cells[1] && file; first += stripe_rows) {
+            const std::size_t end{std::min(first + stripe_rows, num_cells[1])};
+            // Scenarios may throw, which must not leave the parallel region
+#pragma omp parallel for schedule(static) default(none) \
+        shared(scen, origin, cell_size, num_cells, first, end, b, h, error)
+            for (std::size_t block = first; block < end; block += sample_block_rows) {
+                try {
+                    scen.sample_rows(origin, cell_size, num_cells, {block, std::min(block + sample_block_rows, end)},
+                                     b.data() + (block - first) * num_cells[0],
+                                     h.data() + (block - first) * num_cells[0]);
+                } catch (...) {
+#pragma omp critical
+                    error = std::current_exception();
+                }
+            }
+            if (error) {
+                // Discards the file
+                file.setstate(std::ios::failbit);
+                return;
+            }
+
+            // The padding in front of both grids is left to the file system, which fills skipped bytes with zeros
+            const std::size_t bytes{(end - first) * row_bytes};
+            header.checksums[0] = hash_bytes(header.checksums[0], b.data(), bytes);
+            header.checksums[1] = hash_bytes(header.checksums[1], h.data(), bytes);
+            file.seekp(static_cast<std::streamoff>(offsets[0] + first * row_bytes));
+            file.write(reinterpret_cast<const char *>(b.data()), static_cast<std::streamsize>(bytes));
+            file.seekp(static_cast<std::streamoff>(offsets[1] + first * row_bytes));
+            file.write(reinterpret_cast<const char *>(h.data()), static_cast<std::streamsize>(bytes));
+        }
+        file.seekp(0);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    })};
+    if (error) { std::rethrow_exception(error); }
+    if (!written) { return std::nullopt; }
+
+    // The values were just hashed while writing them
+    return map(path, *state_key, bathy_name, displ_name, false);
+}
+
+std::size_t cached_scenario::get_index(const float &x, const float &y) const {
+    if (x < origin[0] || x >= origin[0] + size[0] || y < origin[1] || y >= origin[1] + size[1]) {
+        throw std::logic_error("Index outside scenario bounds!");
+    }
+    return std::min(static_cast<std::size_t>((y - origin[1]) / cell_size[1]), num_cells[1] - 1) * num_cells[0] +
+           std::min(static_cast<std::size_t>((x - origin[0]) / cell_size[0]), num_cells[0] - 1);
+}
+
+std::array<float, 2> cached_scenario::get_origin() const { return origin; }
+
+std::array<float, 2> cached_scenario::get_size() const { return size; }
+
+float cached_scenario::get_bathymetry(const float &x, const float &y) const { return b[get_index(x, y)]; }
+
+float cached_scenario::get_height(const float &x, const float &y) const { return h[get_index(x, y)]; }
+
+void cached_scenario::sample_rows(const std::array<float, 2> &origin,
+                                  const std::array<float, 2> &cell_size,
+                                  const std::array<std::size_t, 2> &num_cells,
+                                  const std::array<std::size_t, 2> &rows,
+                                  float *b_out,
+                                  float *h_out) const {
+    if (origin != this->origin || cell_size != this->cell_size || num_cells != this->num_cells) {
+        scenario::sample_rows(origin, cell_size, num_cells, rows, b_out, h_out);
+        return;
+    }
+    std::copy(b + rows[0] * num_cells[0], b + rows[1] * num_cells[0], b_out);
+    std::copy(h + rows[0] * num_cells[0], h + rows[1] * num_cells[0], h_out);
+}
+
 std::array<float, 2> artificial_tsunami_scenario::get_origin() const { return {-5000.F, -5000.F}; }
 
 std::array<float, 2> artificial_tsunami_scenario::get_size() const { return {10000.F, 10000.F}; }
@@ -113,6 +729,40 @@ float artificial_tsunami_scenario::get_bathymetry(const float &x, const float &y
 
 float artificial_tsunami_scenario::get_height(const float &x, const float &y) const { return 100.F; }
 
+void artificial_tsunami_scenario::sample_rows(const std::array<float, 2> &origin,
+                                              const std::array<float, 2> &cell_size,
+                                              const std::array<std::size_t, 2> &num_cells,
+                                              const std::array<std::size_t, 2> &rows,
+                                              float *b_out,
+                                              float *h_out) const {
+    const std::vector<float> x{cellCenters(origin[0], cell_size[0], {0, num_cells[0]})};
+    const std::vector<float> y{cellCenters(origin[1], cell_size[1], rows)};
+
+    // Displacement along x, 0 outside of the displaced square
+    std::vector<float> profile_x(num_cells[0], 0.F);
+    for (std::size_t i{0}; i < num_cells[0]; ++i) {
+        if (x[i] >= -500.F && x[i] <= 500.F) {
+            profile_x[i] = 5.F * std::sin((x[i] / 500.F + 1.F) * static_cast<float>(M_PI));
+        }
+    }
+
+    for (std::size_t j{0}; j < y.size(); ++j) {
+        float *b_cells{b_out + j * num_cells[0]};
+        float *h_cells{h_out + j * num_cells[0]};
+        if (y[j] >= -500.F && y[j] <= 500.F) {
+            const float profile_y{-(y[j] * y[j] / 250000.F) + 1.F};
+            for (std::size_t i = 0; i < num_cells[0]; ++i) {
+                b_cells[i] = -100.F + profile_x[i] * profile_y;
+            }
+        } else {
+            std::fill_n(b_cells, num_cells[0], -100.F);
+        }
+        for (std::size_t i = 0; i < num_cells[0]; ++i) {
+            h_cells[i] = b_cells[i] >= 0.F ? 0.F : 100.F;
+        }
+    }
+}
+
 std::array<float, 2> radial_dambreak_obstacle_scenario::get_origin() const { return {0.F, 0.F}; }
 
 std::array<float, 2> radial_dambreak_obstacle_scenario::get_size() const { return {1000.F, 1000.F}; }
@@ -125,3 +775,31 @@ float radial_dambreak_obstacle_scenario::get_height(const float &x, const float
     if (get_bathymetry(x, y) >= 0.F) { return 0.F; }
     return (std::sqrt((x - 500.F) * (x - 500.F) + (y - 500.F) * (y - 500.F)) < 100.F) ? 40.F : 20.F;
 }
+
+void radial_dambreak_obstacle_scenario::sample_rows(const std::array<float, 2> &origin,
+                                                    const std::array<float, 2> &cell_size,
+                                                    const std::array<std::size_t, 2> &num_cells,
+                                                    const std::array<std::size_t, 2> &rows,
+                                                    float *b_out,
+                                                    float *h_out) const {
+    const std::vector<float> x{cellCenters(origin[0], cell_size[0], {0, num_cells[0]})};
+    const std::vector<float> y{cellCenters(origin[1], cell_size[1], rows)};
+
+    // Squared distances from the center of the dam along x
+    std::vector<float> distance_x(num_cells[0]);
+    for (std::size_t i{0}; i < num_cells[0]; ++i) {
+        distance_x[i] = (x[i] - 500.F) * (x[i] - 500.F);
+    }
+
+    for (std::size_t j{0}; j < y.size(); ++j) {
+        float *b_cells{b_out + j * num_cells[0]};
+        float *h_cells{h_out + j * num_cells[0]};
+        const bool obstacle_y{475.F <= y[j] && y[j] < 525.F};
+        const float distance_y{(y[j] - 500.F) * (y[j] - 500.F)};
+        for (std::size_t i = 0; i < num_cells[0]; ++i) {
+            const bool obstacle{obstacle_y && 725.F <= x[i] && x[i] < 775.F};
+            b_cells[i] = obstacle ? 20.F : -20.F;
+            h_cells[i] = obstacle ? 0.F : (std::sqrt(distance_x[i] + distance_y) < 100.F ? 40.F : 20.F);
+        }
+    }
+}
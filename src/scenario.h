@@ -1,11 +1,31 @@
 #ifndef SCENARIO_H
 #define SCENARIO_H
 
+#include "cache.h"
+
 #include <array>
 #include <cstddef>
-#include <netcdf>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
 #include <vector>
 
+/** Rectangular part of a scenario domain, e.g. the part to simulate */
+struct region {
+  /** Origin (i.e. bottom left) position */
+  std::array<float, 2> origin{0.F, 0.F};
+
+  /** Size in x and y direction, 0 stands for the whole domain */
+  std::array<float, 2> size{0.F, 0.F};
+
+  /**
+   * Whether this region stands for the whole domain
+   * @return true if the region has no area
+   */
+  [[nodiscard]] bool whole() const { return size[0] <= 0.F || size[1] <= 0.F; }
+};
+
 /** Provides initial bathymetry and water height data for simulations. This is an abstract class. It only declares the functions a scenario class must have. */
 class scenario {
 public:
@@ -38,9 +58,46 @@ public:
    * @return Initial water height at position (x, y)
    */
   [[nodiscard]] virtual float get_height(const float& x, const float& y) const = 0;
+
+  /**
+   * Samples bathymetry and initial water height at the centers of a grid of cells, in parallel by blocks of rows, see
+   * sample_rows
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param cell_size Size of the cells in x and y direction
+   * @param num_cells Number of cells in x and y direction
+   * @param b_out Bathymetry of all cells, numbered row by row
+   * @param h_out Water height of all cells, numbered row by row
+   */
+  void sample_grid(const std::array<float, 2>& origin,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<std::size_t, 2>& num_cells,
+                   float* b_out,
+                   float* h_out) const;
+
+  /**
+   * Samples bathymetry and initial water height at the centers of some rows of a grid of cells on the calling thread,
+   * so callers decide which thread writes which rows. Rows get the same values as from sample_grid. Heights of cells
+   * with bathymetry >= 0 are 0. The default calls get_bathymetry and get_height per cell, scenarios override it with
+   * loops that hoist everything depending only on the row or the column.
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param cell_size Size of the cells in x and y direction
+   * @param num_cells Number of cells of the whole grid in x and y direction
+   * @param rows First row and one past the last row to sample
+   * @param b_out Bathymetry of the rows, numbered row by row
+   * @param h_out Water height of the rows, numbered row by row
+   */
+  virtual void sample_rows(const std::array<float, 2>& origin,
+                           const std::array<float, 2>& cell_size,
+                           const std::array<std::size_t, 2>& num_cells,
+                           const std::array<std::size_t, 2>& rows,
+                           float* b_out,
+                           float* h_out) const;
 };
 
-/** Loads scenario data from a bathymetry and a displacement file. */
+/**
+ * Loads scenario data from a bathymetry and a displacement file. Only the part of the files covering a region of
+ * interest is read, so a sub-basin can be simulated from global bathymetry.
+ */
 class file_scenario final : public scenario {
 private:
   /** Number of bathymetry cells in x and y direction */
@@ -67,6 +124,9 @@ private:
   /** Displacement origin */
   const std::array<float, 2> orig_d;
 
+  /** Part of the files covered by the bathymetry that was loaded, see get_origin and get_size */
+  const region domain;
+
   /**
    * Creates scenario from extracted file data.
    * @param num_b Number of bathymetry cells in x and y direction
@@ -77,6 +137,7 @@ private:
    * @param d Displacement values in scenario
    * @param size_d Size of displacement cells in x and y direction
    * @param orig_d Origin (bottom left corner) position of displacement in scenario
+   * @param domain Part of the files covered by the bathymetry
    */
   file_scenario(const std::array<std::size_t, 2>& num_b,
                 std::vector<float>& b,
@@ -85,7 +146,8 @@ private:
                 const std::array<std::size_t, 2>& num_d,
                 std::vector<float>& d,
                 const std::array<float, 2>& size_d,
-                const std::array<float, 2>& orig_d);
+                const std::array<float, 2>& orig_d,
+                const region& domain);
 
   /**
    * Convert x and y coordinates to closest corresponding array index
@@ -102,14 +164,161 @@ private:
                                const std::array<float, 2>& cell_size,
                                const std::array<float, 2>& origin);
 
+public:
+  /** Cells read around the region of interest in each direction, so cell centers on its border find their data */
+  static constexpr std::size_t load_margin{2};
+
+  /**
+   * Extracts data from bathymetry and displacement files to create a scenario. Opens each file once, checks its grid
+   * and reads the hyperslab covering the region of interest plus load_margin cells, widened to whole chunks of chunked
+   * files. Both files are read at the same time in blocks of rows, checking that all values are finite. If the
+   * scenario will be sampled at least twice as coarse as the bathymetry, the bathymetry comes from the coarsest level
+   * of its bathymetry_pyramid that is still as fine as the cells. Without a cached pyramid the level is averaged from
+   * the cells read, and loads of the whole file cache the pyramid.
+   * @param bathy_name Name of bathymetry file
+   * @param displ_name Name of displacement file
+   * @param roi Region of interest, the whole bathymetry by default
+   * @param num_cells Number of cells the region will be sampled with in x and y direction, 0 for full resolution
+   * @param progress Called with the fraction of values read so far, from the threads reading the files. Exceptions it
+   * throws, e.g. canceled_error, stop loading and are passed on.
+   * @return Scenario covering at least the region of interest
+   * @throws std::runtime_error If a file is not valid, or the displacement or the region lies outside the bathymetry
+   */
+  [[nodiscard]] static file_scenario create(const std::string& bathy_name,
+                                            const std::string& displ_name,
+                                            const region& roi = {},
+                                            const std::array<std::size_t, 2>& num_cells = {0, 0},
+                                            const std::function<void(const float&)>& progress = {});
+
+  /** See scenario::get_origin. */
+  [[nodiscard]] std::array<float, 2> get_origin() const final;
+
+  /** See scenario::get_size. */
+  [[nodiscard]] std::array<float, 2> get_size() const final;
+
+  /** See scenario::get_bathymetry. */
+  [[nodiscard]] float get_bathymetry(const float& x, const float& y) const final;
+
+  /** See scenario::get_height. */
+  [[nodiscard]] float get_height(const float& x, const float& y) const final;
+
+  /** See scenario::sample_rows. */
+  void sample_rows(const std::array<float, 2>& origin,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<std::size_t, 2>& num_cells,
+                   const std::array<std::size_t, 2>& rows,
+                   float* b_out,
+                   float* h_out) const final;
+};
+
+/**
+ * Bathymetry and initial water height of a scenario sampled on the grid of a simulation, cached on disk and mapped
+ * into memory. Reruns with the same files, region of interest and number of cells skip reading and sampling the files.
+ */
+class cached_scenario final : public scenario {
+private:
+  /** Mapped cache file */
+  mapped_file file;
+
+  /** Number of cells in x and y direction */
+  std::array<std::size_t, 2> num_cells;
+
+  /** Origin (i.e. bottom left) position of the grid */
+  std::array<float, 2> origin;
+
+  /** Size of the grid in x and y direction */
+  std::array<float, 2> size;
+
+  /** Size of the cells in x and y direction, derived from size like simulations do */
+  std::array<float, 2> cell_size;
+
+  /** Bathymetry of all cells, numbered row by row, within the mapping */
+  const float* b;
+
+  /** Water height of all cells, numbered row by row, within the mapping */
+  const float* h;
+
+  /**
+   * Constructor
+   * @param file Mapped cache file
+   * @param num_cells Number of cells in x and y direction
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param size Size of the grid in x and y direction
+   * @param b_offset Position of the bathymetry within the file in bytes
+   * @param h_offset Position of the water height within the file in bytes
+   */
+  cached_scenario(mapped_file file,
+                  const std::array<std::size_t, 2>& num_cells,
+                  const std::array<float, 2>& origin,
+                  const std::array<float, 2>& size,
+                  const std::size_t& b_offset,
+                  const std::size_t& h_offset);
+
+  /**
+   * Key of a sampled state
+   * @param bathy_name Name of bathymetry file
+   * @param displ_name Name of displacement file
+   * @param roi Region of interest
+   * @param num_cells Number of cells in x and y direction
+   * @return Key, or nothing if a file can't be read
+   */
+  static std::optional<std::uint64_t> key(const std::string& bathy_name,
+                                          const std::string& displ_name,
+                                          const region& roi,
+                                          const std::array<std::size_t, 2>& num_cells);
+
+  /**
+   * Maps a cache file and checks its contents against the checksums in its header, and the grids it was sampled from
+   * against the headers of the files
+   * @param path Cache file
+   * @param key Key of the sampled state
+   * @param bathy_name Name of bathymetry file
+   * @param displ_name Name of displacement file
+   * @param check_values Whether to check the values against the checksums, not needed for a file just written
+   * @return Scenario, or nothing if the file is missing, corrupt or doesn't belong to the key and the files
+   */
+  static std::optional<cached_scenario> map(const std::string& path,
+                                            const std::uint64_t& key,
+                                            const std::string& bathy_name,
+                                            const std::string& displ_name,
+                                            const bool& check_values);
+
+  /**
+   * Cell containing a position
+   * @param x Position in x direction
+   * @param y Position in y direction
+   * @return Index of the cell
+   */
+  [[nodiscard]] std::size_t get_index(const float& x, const float& y) const;
+
 public:
   /**
-   * Extracts data from bathymetry and displacement files to create a scenario
+   * Maps the sampled state of an earlier run
    * @param bathy_name Name of bathymetry file
    * @param displ_name Name of displacement file
-   * @return Scenario
+   * @param roi Region of interest, as passed to file_scenario::create and sim_options
+   * @param num_cells Number of cells in x and y direction
+   * @return Scenario, or nothing if the state isn't cached
    */
-  [[nodiscard]] static file_scenario create(const std::string& bathy_name, const std::string& displ_name);
+  static std::optional<cached_scenario> open(const std::string& bathy_name,
+                                             const std::string& displ_name,
+                                             const region& roi,
+                                             const std::array<std::size_t, 2>& num_cells);
+
+  /**
+   * Samples a scenario on the grid a simulation of it would use and caches the result
+   * @param scen Scenario created from the files
+   * @param bathy_name Name of bathymetry file
+   * @param displ_name Name of displacement file
+   * @param roi Region of interest, as passed to file_scenario::create and sim_options
+   * @param num_cells Number of cells in x and y direction
+   * @return Scenario, or nothing if no cache file could be written
+   */
+  static std::optional<cached_scenario> store(const scenario& scen,
+                                              const std::string& bathy_name,
+                                              const std::string& displ_name,
+                                              const region& roi,
+                                              const std::array<std::size_t, 2>& num_cells);
 
   /** See scenario::get_origin. */
   [[nodiscard]] std::array<float, 2> get_origin() const final;
@@ -122,6 +331,14 @@ public:
 
   /** See scenario::get_height. */
   [[nodiscard]] float get_height(const float& x, const float& y) const final;
+
+  /** See scenario::sample_rows. Copies the cached cells if the grid is the cached one. */
+  void sample_rows(const std::array<float, 2>& origin,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<std::size_t, 2>& num_cells,
+                   const std::array<std::size_t, 2>& rows,
+                   float* b_out,
+                   float* h_out) const final;
 };
 
 /** Artificial scenario using positive and negative displacements */
@@ -138,6 +355,14 @@ public:
 
   /** See scenario::get_height. */
   [[nodiscard]] float get_height(const float& x, const float& y) const final;
+
+  /** See scenario::sample_rows. */
+  void sample_rows(const std::array<float, 2>& origin,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<std::size_t, 2>& num_cells,
+                   const std::array<std::size_t, 2>& rows,
+                   float* b_out,
+                   float* h_out) const final;
 };
 
 /** Radial dambreak scenario with an obstacle */
@@ -154,67 +379,14 @@ public:
 
   /** See scenario::get_height. */
   [[nodiscard]] float get_height(const float& x, const float& y) const final;
-};
 
-/**
- * Checks a bathymetry or displacement file for basic correctness.
- * @param filename Name of file to be checked
- * @return true for correct files, false otherwise
- */
-inline bool verify_input(const std::string& filename) {
-  // Check that file exists and is accessible
-  netCDF::NcFile file{};
-  try {
-    file.open(filename, netCDF::NcFile::read);
-  } catch (...) {
-    return false;
-  }
-  if (file.isNull()) {
-    return false;
-  }
-
-  // Check that dimensions exist
-  netCDF::NcDim dim_x{file.getDim("x")};
-  netCDF::NcDim dim_y{file.getDim("y")};
-  if (dim_x.isNull() || dim_y.isNull()) {
-    return false;
-  }
-
-  // Check that dimensions aren't empty, need at least 2 cells in each
-  // direction to be able to calculate cell size
-  std::size_t size_dim_x{dim_x.getSize()};
-  std::size_t size_dim_y{dim_y.getSize()};
-  if (size_dim_x < 2 || size_dim_y < 2) {
-    return false;
-  }
-
-  // Check that variables exist
-  netCDF::NcVar var_x{file.getVar("x")};
-  netCDF::NcVar var_y{file.getVar("y")};
-  netCDF::NcVar var_z{file.getVar("z")};
-  if (var_x.isNull() || var_y.isNull() || var_z.isNull()) {
-    return false;
-  }
-
-  // Check that coordinate variables are strictly monotonous and increasing
-  std::vector<float> x_values(size_dim_x);
-  var_x.getVar(x_values.data());
-  for (std::size_t i{1}; i < size_dim_x; ++i) {
-    if (x_values[i - 1] >= x_values[i]) {
-      return false;
-    }
-  }
-
-  std::vector<float> y_values(size_dim_y);
-  var_y.getVar(y_values.data());
-  for (std::size_t i{1}; i < size_dim_y; ++i) {
-    if (y_values[i - 1] >= y_values[i]) {
-      return false;
-    }
-  }
-
-  // All checks passed
-  return true;
-}
+  /** See scenario::sample_rows. */
+  void sample_rows(const std::array<float, 2>& origin,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<std::size_t, 2>& num_cells,
+                   const std::array<std::size_t, 2>& rows,
+                   float* b_out,
+                   float* h_out) const final;
+};
 
 #endif  // SCENARIO_H
@@ -1,319 +1,679 @@
 #include "simulation.h"
 
-simulation::simulation(const std::array<std::size_t, 2> &num_cells,
-                       const std::array<float, 2> &cell_size,
-                       const std::array<float, 2> &origin,
-                       const bool &reflective_bounds,
-                       const std::vector<float> &b,
-                       const std::vector<float> &h,
-                       const std::vector<float> &hu,
-                       const std::vector<float> &hv,
-                       const float &time,
-                       const float &duration,
-                       const int &num_threads)
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <sched.h>
+#include <type_traits>
+#include <utility>
+
+template <typename precision, typename layout>
+basic_simulation<precision, layout>::basic_simulation(const std::array<std::size_t, 2> &num_cells,
+                                                      const std::array<float, 2> &cell_size,
+                                                      const std::array<float, 2> &origin,
+                                                      const bool &reflective_bounds,
+                                                      const scenario &scen,
+                                                      const float &time,
+                                                      const float &duration,
+                                                      const int &num_threads,
+                                                      const sweep_kernel &kernel,
+                                                      const std::array<std::size_t, 2> &tile_size,
+                                                      const std::size_t &time_block_steps,
+                                                      const bool &precompute_cell_terms,
+                                                      const instruction_set &kernel_isa,
+                                                      const bool &bind_threads,
+                                                      const cancel_token &cancel)
         : num_cells{num_cells},
           cell_size{cell_size},
           origin{origin},
           reflective_bounds{reflective_bounds},
-          b{b},
-          h{h},
-          hu{hu},
-          hv{hv},
+          row_chunks{splitRows(scen, origin, cell_size, num_cells)},
+          state{sampleCells(scen, origin, cell_size, num_cells, row_chunks)},
+          b{state.b()},
+          h{state.h()},
+          hu{state.hu()},
+          hv{state.hv()},
           time{time},
-          duration{duration} { omp_set_num_threads(num_threads); }
+          duration{duration},
+          stop{cancel},
+          kernel{kernel},
+          tile_size{tile_size},
+          time_block_steps{time_block_steps},
+          precompute_cell_terms{precompute_cell_terms},
+          kernel_isa{kernel_isa},
+          num_threads{num_threads},
+          bind_threads{bind_threads} {
+    // Kernels for the chosen instruction set and boundary condition. Only generic ones exist outside of x86.
+    switch (kernel_isa) {
+#ifdef SWE_ISA_DISPATCH
+        case instruction_set::sse42:
+            selectBoundaryKernels<isa_sse42>();
+            break;
+        case instruction_set::avx2:
+            selectBoundaryKernels<isa_avx2>();
+            break;
+        case instruction_set::avx512:
+            selectBoundaryKernels<isa_avx512>();
+            break;
+#endif
+        default:
+            selectBoundaryKernels<isa_generic>();
+            break;
+    }
+
+    // Bathymetry doesn't change during the run, so wet cells and edges can be classified once
+    buildWetSpans();
+    buildEdgeTables();
+
+    // Net updates of one sweep, edges in x direction need one more column than cells. Only the split kernel needs them.
+    const std::size_t num_updates{kernel == sweep_kernel::split ? (num_cells[0] + 1) * (num_cells[1] + 2) : 0};
+
+    // Every thread works on its own tile
+    const bool tiled{kernel == sweep_kernel::tiled || kernel == sweep_kernel::temporal};
+    const std::size_t num_tiles{tiled ? static_cast<std::size_t>(omp_get_max_threads()) : 0};
+
+    // Velocities and square roots of the heights, if the split kernel precomputes them
+    const std::size_t num_cells_total{num_cells[0] * (num_cells[1] + 2)};
+    const std::size_t num_cell_terms{kernel == sweep_kernel::split && precompute_cell_terms ? num_cells_total : 0};
+
+    // A few rows of net updates per chunk of rows, if the fused kernel sweeps them
+    const std::size_t num_fused_updates{
+            kernel == sweep_kernel::fused ? fused_update_rows * (row_chunks.size() - 1) * num_cells[0] : 0};
 
-simulation simulation::create(const scenario &scen, const sim_options &sim_opt) {
+    std::vector<std::size_t> sizes{num_updates, num_updates, num_updates, num_updates, num_cell_terms, num_cell_terms,
+                                   num_fused_updates};
+    sizes.resize(sizes.size() + num_tiles, tileScratchSize());
+    scratch.reserve(sizes);
+    h_updates_neg = scratch.take(num_updates);
+    h_updates_pos = scratch.take(num_updates);
+    hu_updates_neg = scratch.take(num_updates);
+    hu_updates_pos = scratch.take(num_updates);
+    cell_velocity = scratch.take(num_cell_terms);
+    cell_sqrt_h = scratch.take(num_cell_terms);
+    fused_updates = scratch.take(num_fused_updates);
+
+    // Dry cells are never computed, but solved as masked lanes
+    std::fill_n(cell_velocity, num_cell_terms, 0.F);
+    std::fill_n(cell_sqrt_h, num_cell_terms, 0.F);
+    for (std::size_t i{0}; i < num_tiles; ++i) {
+        tile_scratch.push_back(scratch.take(tileScratchSize()));
+    }
+    team_slots.resize(static_cast<std::size_t>(omp_get_max_threads()));
+
+    // The tiled kernels write new cells into a second set of cells, starting as a copy of the current ones
+    if (tiled) {
+        buildWetTiles();
+        state_next = cells{num_cells[0], num_cells[1] + 2, row_chunks,
+                           [&](cells &target, const std::size_t &first, const std::size_t &end) {
+                               const auto b_cells{target.b()};
+                               const auto h_cells{target.h()};
+                               const auto hu_cells{target.hu()};
+                               const auto hv_cells{target.hv()};
+                               for (std::size_t cell{first * num_cells[0]}; cell < end * num_cells[0]; ++cell) {
+                                   b_cells[cell] = b[cell];
+                                   h_cells[cell] = h[cell];
+                                   hu_cells[cell] = hu[cell];
+                                   hv_cells[cell] = hv[cell];
+                               }
+                           }};
+        b_next = state_next.b();
+        h_next = state_next.h();
+        hu_next = state_next.hu();
+        hv_next = state_next.hv();
+    }
+}
+
+template <typename precision, typename layout>
+basic_simulation<precision, layout> basic_simulation<precision, layout>::create(const scenario &scen, const sim_options &sim_opt) {
     // Number of cells
     auto num_cells{sim_opt.num_cells};
 
+    // Simulated part of the scenario
+    const auto scen_origin{scen.get_origin()};
+    const auto scen_size{scen.get_size()};
+    const region &roi{sim_opt.region_of_interest};
+    if (!roi.whole() && (roi.origin[0] < scen_origin[0] || roi.origin[1] < scen_origin[1] ||
+                         roi.origin[0] + roi.size[0] > scen_origin[0] + scen_size[0] ||
+                         roi.origin[1] + roi.size[1] > scen_origin[1] + scen_size[1])) {
+        throw std::runtime_error("Region of interest outside of scenario!");
+    }
+    const std::array<float, 2> origin{roi.whole() ? scen_origin : roi.origin};
+    const std::array<float, 2> size{roi.whole() ? scen_size : roi.size};
+
     // Cell size
-    auto scen_size{scen.get_size()};
-    std::array<float, 2> cell_size{scen_size[0] / num_cells[0], scen_size[1] / num_cells[1]};
-
-    // Bathymetry and water height
-    auto origin{scen.get_origin()};
-    std::vector<float> b(num_cells[0] * (num_cells[1] + 2));
-    std::vector<float> h(num_cells[0] * (num_cells[1] + 2));
-    // Initialize inner cells
-    for (std::size_t y{1}; y <= num_cells[1]; ++y) {
-        for (std::size_t x{0}; x < num_cells[0]; ++x) {
-            b[y * num_cells[0] + x] = scen.get_bathymetry(origin[0] + (static_cast<float>(x) + .5F) * cell_size[0],
-                                                          origin[1] + (static_cast<float>(y) - .5F) * cell_size[1]);
-            h[y * num_cells[0] + x] = b[y * num_cells[0] + x] >= 0.F ? 0.F : scen.get_height(
-                    origin[0] + (static_cast<float>(x) + .5F) * cell_size[0],
-                    origin[1] + (static_cast<float>(y) - .5F) * cell_size[1]);
-        }
+    std::array<float, 2> cell_size{size[0] / num_cells[0], size[1] / num_cells[1]};
+
+    // Threads are placed before any cell is touched, the cells are sampled by the threads computing them
+    placeThreads(sim_opt.num_threads, sim_opt.bind_threads);
+
+    return basic_simulation{num_cells,
+                            cell_size,
+                            origin,
+                            sim_opt.reflective_bounds,
+                            scen,
+                            0.F,
+                            sim_opt.duration,
+                            sim_opt.num_threads,
+                            sim_opt.kernel,
+                            sim_opt.tile_size[0] == 0 || sim_opt.tile_size[1] == 0 ? selectTileSize(num_cells)
+                                                                                   : sim_opt.tile_size,
+                            sim_opt.time_block_steps == 0 ? default_time_block_steps : sim_opt.time_block_steps,
+                            sim_opt.precompute_cell_terms,
+                            selectInstructionSet(sim_opt.kernel_isa),
+                            sim_opt.bind_threads,
+                            sim_opt.cancel};
+}
+
+template <typename precision, typename layout>
+instruction_set basic_simulation<precision, layout>::selectInstructionSet(const instruction_set &requested) {
+    // Best instruction set of this CPU with compiled kernels
+    instruction_set supported{instruction_set::generic};
+#ifdef SWE_ISA_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        supported = instruction_set::avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        supported = instruction_set::avx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        supported = instruction_set::sse42;
     }
+#endif
 
-    // Initialize boundary bathymetry at bottom and top
-    for (std::size_t x{0}; x < num_cells[0]; ++x) {
-        b[x] = b[num_cells[0] + x];
-        b[(num_cells[1] + 1) * num_cells[0] + x] = b[num_cells[1] * num_cells[0] + x];
+    // The environment can override the automatic choice, e.g. for benchmarks
+    instruction_set chosen{requested};
+    const char *name{std::getenv("SWE_ISA")};
+    if (chosen == instruction_set::automatic && name != nullptr) {
+        const std::string env{name};
+        if (env == "generic") {
+            chosen = instruction_set::generic;
+        } else if (env == "sse42") {
+            chosen = instruction_set::sse42;
+        } else if (env == "avx2") {
+            chosen = instruction_set::avx2;
+        } else if (env == "avx512") {
+            chosen = instruction_set::avx512;
+        } else {
+            throw std::runtime_error("Unknown instruction set in SWE_ISA!");
+        }
     }
 
-    return simulation{num_cells,
-                      cell_size,
-                      origin,
-                      sim_opt.reflective_bounds,
-                      b,
-                      h,
-                      std::vector<float>(num_cells[0] * (num_cells[1] + 2)),
-                      std::vector<float>(num_cells[0] * (num_cells[1] + 2)),
-                      0.F,
-                      sim_opt.duration,
-                      sim_opt.num_threads};
+    if (chosen == instruction_set::automatic) { return supported; }
+    if (chosen > supported) { throw std::runtime_error("Instruction set not supported by this CPU or build!"); }
+    return chosen;
 }
 
-void simulation::run(output_options out_opt) {
-    bool error_happened{false};
-    //omp_set_num_threads(num_threads == 0 ? (std::max<int>(std::thread::hardware_concurrency(), 1)) : num_threads);
+template <typename precision, typename layout>
+template <typename isa>
+void basic_simulation<precision, layout>::selectBoundaryKernels() {
+    if (reflective_bounds) {
+        selectKernels<wall_boundary, isa>();
+    } else {
+        selectKernels<outflow_boundary, isa>();
+    }
+}
+
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::run(output_options out_opt) {
+    // Run may be called from another thread than create, which starts its own team of OpenMP threads
+    placeThreads(num_threads, bind_threads);
+
+    // Log which pages the kernel gave the grids, huge pages matter a lot for large grids
+    std::clog << describe_grid_pages() << std::endl;
+    std::clog << describe_memory_usage() << std::endl;
+
     // Time at which simulation started
     const auto start_time{std::chrono::high_resolution_clock::now()};
 
-    // With or without output
-    if (out_opt.create_output) {
-        // Amount of timesteps currently in output file
-        std::size_t timesteps_written{1};
+    // Amount of timesteps currently in output file
+    std::size_t timesteps_written{1};
 
-        // Initialize writer
-        writer out_writer{out_opt.output_name,
+    // Initialize writer, if output should be created
+    std::optional<writer<precision, layout>> out_writer;
+    if (out_opt.create_output) {
+        out_writer.emplace(out_opt.output_name,
                 //out_opt.checkpoint_name,
-                          num_cells, origin, cell_size,
+                           num_cells, origin, cell_size,
                 //out_opt.coarse_factor,
                 //duration,
                 //use_walls,
                 //out_opt.num_timesteps,
-                          time, b, h, hu, hv, timesteps_written};
-
-        // Loop until end of simulation
-        while (time < duration) {
-            computeTimestep(error_happened);
-            if (stop) { return; }
-            if (error_happened) {
-                out_opt.gui.show_error_page("Negative water height encountered during calculations!");
-                return;
-            }
-            // Write current data to output
-            if (out_opt.max_num_timesteps == 0 || time >= duration / out_opt.max_num_timesteps * timesteps_written) {
-                out_writer.write();
-                ++timesteps_written;
-            }
-            if (time <= 0.F) { throw std::runtime_error{"No time has passed during timestep!"}; }
-            // Tell GUI, how much time is remaining
-            out_opt.gui.update_progress(std::min<float>(time / duration, .99F), std::max(static_cast<int>(
-                                                                                                 std::chrono::duration_cast<std::chrono::seconds>(
-                                                                                                         std::chrono::high_resolution_clock::now() -
-                                                                                                         start_time).count() *
-                                                                                                 (duration - time) /
-                                                                                                 time + .5F),
-                                                                                         1));
-        }
-    } else {
-        // Loop until end of simulation
-        while (time < duration) {
-            computeTimestep(error_happened);
-            if (stop) { return; }
-            if (error_happened) {
-                out_opt.gui.show_error_page("Negative water height encountered during calculations!");
-                return;
+                           time, b, h, hu, hv, timesteps_written);
+    }
+
+    // No cell failed and nothing was allocated yet
+    for (team_slot &slot : team_slots) {
+        slot.failed_cell = no_cell;
+        slot.allocations = 0;
+    }
+
+    // One team of threads runs all timesteps instead of starting a parallel region per loop. Thread 0 keeps track of
+    // time, output and progress between the timesteps and tells the others whether to go on.
+    bool running{time < duration};
+    bool canceled{false};
+    bool error_happened{false};
+    std::exception_ptr exception;
+#pragma omp parallel default(none) shared(out_opt, start_time, timesteps_written, out_writer, running, canceled, \
+                                          error_happened, exception)
+    {
+        (this->*update_ghost_rows)();
+#pragma omp barrier
+
+        bool step_failed{false};
+        while (running) {
+            computeTimestep(step_failed);
+            if (omp_get_thread_num() == 0) {
+                // Exceptions can't leave the parallel region, they are thrown once all threads are done
+                try {
+                    canceled = stop.is_canceled();
+                    error_happened = step_failed;
+                    running = !canceled && !error_happened && time < duration;
+                    if (!canceled && !error_happened) {
+                        // Write current data to output
+                        if (out_writer && (out_opt.max_num_timesteps == 0 ||
+                                           time >= duration / out_opt.max_num_timesteps * timesteps_written)) {
+                            out_writer->write();
+                            ++timesteps_written;
+                        }
+                        if (time <= 0.F) { throw std::runtime_error{"No time has passed during timestep!"}; }
+                        // Tell GUI, how much time is remaining
+                        const auto elapsed{std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::high_resolution_clock::now() - start_time).count()};
+                        out_opt.gui.update_progress(std::min<float>(time / duration, .99F),
+                                                    std::max(static_cast<int>(elapsed * (duration - time) / time + .5F),
+                                                             1));
+                    }
+                } catch (...) {
+                    exception = std::current_exception();
+                    running = false;
+                }
             }
-            //Tell GUI, how much time is remaining
-            out_opt.gui.update_progress(std::min<float>(time / duration, .99F), std::max(static_cast<int>(
-                                                                                                 std::chrono::duration_cast<std::chrono::seconds>(
-                                                                                                         std::chrono::high_resolution_clock::now() -
-                                                                                                         start_time).count() *
-                                                                                                 (duration - time) /
-                                                                                                 time + .5F),
-                                                                                         1));
+            // The output reads the cells and the timesteps read running, so the others wait for thread 0. Thread 0
+            // only changes running again after the barriers of the next timestep.
+#pragma omp barrier
         }
     }
+
+    if (exception) { std::rethrow_exception(exception); }
+#ifdef SWE_COUNT_ALLOCATIONS
+    if (get_step_allocations() != 0) {
+        std::clog << "Warning: the timesteps did " << get_step_allocations() << " heap allocations" << std::endl;
+    }
+#endif
+    if (canceled) { return; }
+    if (error_happened) {
+        out_opt.gui.show_error_page(describeError());
+        return;
+    }
     // Tell GUI, that we're done
+    std::clog << describe_memory_usage() << std::endl;
     out_opt.gui.update_progress(1.F, -1.F);
 }
 
-void simulation::computeTimestep(bool &error_happened) {
-    // Set up boundaries according to uses_walls
-#pragma omp parallel for schedule(static) default(none)
-    for (std::size_t x = 0; x < num_cells[0]; ++x) {
-        // Height
-        h[x] = h[num_cells[0] + x];
-        h[(num_cells[1] + 1) * num_cells[0] + x] = h[num_cells[1] * num_cells[0] + x];
-        // Momentum in x direction
-        hu[x] = hu[num_cells[0] + x];
-        hu[(num_cells[1] + 1) * num_cells[0] + x] = hu[num_cells[1] * num_cells[0] + x];
-        // Momentum in y direction
-        hv[x] = reflective_bounds ? -hv[num_cells[0] + x] : hv[num_cells[0] + x];
-        hv[(num_cells[1] + 1) * num_cells[0] + x] = reflective_bounds ? -hv[num_cells[1] * num_cells[0] + x] : hv[
-                num_cells[1] * num_cells[0] + x];
+template <typename precision, typename layout>
+auto basic_simulation<precision, layout>::reduceTeam(const team_result &own) -> team_result {
+    // Calls use the two results of the slots in turns. A thread can only get to the next call once all threads passed
+    // the barrier of this one, so the results it overwrites there have been read by everyone.
+    team_slot &slot{team_slots[static_cast<std::size_t>(omp_get_thread_num())]};
+    slot.turn = 1 - slot.turn;
+    slot.results[slot.turn] = own;
+#pragma omp barrier
+    team_result total{0.F, false};
+    for (std::size_t thread{0}; thread < static_cast<std::size_t>(omp_get_num_threads()); ++thread) {
+        const team_result &result{team_slots[thread].results[slot.turn]};
+        total.max_wave_speed = std::max<real>(total.max_wave_speed, result.max_wave_speed);
+        total.failed = total.failed || result.failed;
     }
+    return total;
+}
 
-    // Pull as much storage as possible out of the loops
-    std::vector<float> h_updates_neg((num_cells[0] + 1) * (num_cells[1] + 2));
-    std::vector<float> h_updates_pos((num_cells[0] + 1) * (num_cells[1] + 2));
-    std::vector<float> hu_updates_neg((num_cells[0] + 1) * (num_cells[1] + 2));
-    std::vector<float> hu_updates_pos((num_cells[0] + 1) * (num_cells[1] + 2));
-    float max_wave_speed{0.F};
-    // X Sweep
-#pragma omp parallel for collapse(2) schedule(static) default(none) shared(h_updates_neg, hu_updates_neg, h_updates_pos, hu_updates_pos) reduction(max \
-                                                                                                                                                 : max_wave_speed)
-    for (std::size_t y = 0; y < num_cells[1] + 2; ++y) {
-        for (std::size_t x = 0; x <= num_cells[0]; ++x) {
-            // Cell indices for this iteration
-            const std::size_t index_r{y * num_cells[0] + x};
-            const std::size_t index_l{index_r - 1};
-            // Set up input for solver
-            std::array<float, 6> in{};
-            if (x == 0) {              // Left border
-                if (b[index_r] >= 0.F) { // Cell dry
-                    continue;
-                } else { // Cell wet
-                    in[3] = b[index_r];
-                    in[4] = h[index_r];
-                    in[5] = hu[index_r];
-                    in[0] = in[3];
-                    in[1] = in[4];
-                    if (reflective_bounds) { // Wall boundaries
-                        in[2] = -in[5];
-                    } else { // Outflow boundaries
-                        in[2] = in[5];
-                    }
-                }
-            } else if (x == num_cells[0]) { // Right border
-                if (b[index_l] >= 0.F) {      // Cell dry
-                    continue;
-                } else { // Cell wet
-                    in[0] = b[index_l];
-                    in[1] = h[index_l];
-                    in[2] = hu[index_l];
-                    in[3] = in[0];
-                    in[4] = in[1];
-                    if (reflective_bounds) { // Wall boundaries
-                        in[5] = -in[2];
-                    } else { // Outflow boundaries
-                        in[5] = in[2];
-                    }
-                }
-            } else {                                        // Inner edge
-                if (b[index_l] >= 0.F && b[index_r] >= 0.F) { // Both cells dry
-                    continue;
-                } else if (b[index_l] >= 0.F) { // Left cell dry
-                    in[3] = b[index_r];
-                    in[4] = h[index_r];
-                    in[5] = hu[index_r];
-                    in[0] = in[3];
-                    in[1] = in[4];
-                    in[2] = -in[5];
-                } else if (b[index_r] >= 0.F) { // Right cell dry
-                    in[0] = b[index_l];
-                    in[1] = h[index_l];
-                    in[2] = hu[index_l];
-                    in[3] = in[0];
-                    in[4] = in[1];
-                    in[5] = -in[2];
-                } else { // Both cells wet
-                    in[0] = b[index_l];
-                    in[1] = h[index_l];
-                    in[2] = hu[index_l];
-                    in[3] = b[index_r];
-                    in[4] = h[index_r];
-                    in[5] = hu[index_r];
-                }
-            }
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::computeTimestep(bool &error_happened) {
+    const std::size_t allocations_before{heap_allocations()};
 
-            // Run solver
-            const std::array<float, 5> result{solve(in)};
+    // Update cells, then ghost rows for the next timestep
+    const real timestep{(this->*compute_sweeps)(error_happened)};
+    (this->*update_ghost_rows)();
 
-            // Store results
-            h_updates_neg[index_r + y] = result[0];
-            hu_updates_neg[index_r + y] = result[1];
-            h_updates_pos[index_r + y] = result[2];
-            hu_updates_pos[index_r + y] = result[3];
+    // Update time, all threads got the same timestep size
+    if (omp_get_thread_num() == 0) { time += static_cast<float>(timestep); }
 
-            // Update maximum wave speed
-            max_wave_speed = std::max<float>(max_wave_speed, result[4]);
+    // Each thread counts its own allocations, see get_step_allocations
+    team_slots[static_cast<std::size_t>(omp_get_thread_num())].allocations += heap_allocations() - allocations_before;
+}
+
+template <typename precision, typename layout>
+std::string basic_simulation<precision, layout>::describeError() const {
+    // Each thread kept the first cell it found when its sweep failed. The earliest sweep wins, then the smallest index.
+    std::pair<std::size_t, std::size_t> first{2, no_cell};
+    for (const team_slot &slot : team_slots) {
+        if (slot.failed_cell != no_cell) {
+            first = std::min(first, std::make_pair(slot.failed_sweep, slot.failed_cell));
         }
     }
+    const std::size_t first_cell{first.second};
 
-    // Calculate timestep size
-    const float timestep{.4F * cell_size[0] / max_wave_speed};
-
-    // Apply updates
-#pragma omp parallel for collapse(2) schedule(static) default(none) shared(h_updates_neg, hu_updates_neg, h_updates_pos, hu_updates_pos, timestep, error_happened)
-    for (std::size_t y = 0; y < num_cells[1] + 2; ++y) {
-        for (std::size_t x = 0; x < num_cells[0]; ++x) {
-            const std::size_t index{y * num_cells[0] + x};
-            if (b[index] < 0.F) {
-                h[index] -= timestep / cell_size[0] * (h_updates_pos[index + y] + h_updates_neg[index + y + 1]);
-                hu[index] -= timestep / cell_size[0] * (hu_updates_pos[index + y] + hu_updates_neg[index + y + 1]);
-                if (h[index] <= 0.F) { error_happened = true; }
+    // Only if a solver saw an invalid cell that no thread could attribute
+    const std::string when{"during the timestep ending at t = " + std::to_string(time) + " s!"};
+    if (first_cell == no_cell) {
+        return "Negative water height encountered " + when;
+    }
+    return "Negative water height encountered at cell (" + std::to_string(first_cell % num_cells[0]) + ", " +
+           std::to_string(first_cell / num_cells[0] - 1) + ") " + when;
+}
+
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::abort() {
+    stop.cancel();
+}
+
+template <typename precision, typename layout>
+std::size_t basic_simulation<precision, layout>::get_step_allocations() const {
+    std::size_t allocations{0};
+    for (const team_slot &slot : team_slots) {
+        allocations += slot.allocations;
+    }
+    return allocations;
+}
+
+template <typename precision, typename layout>
+instruction_set basic_simulation<precision, layout>::get_instruction_set() const {
+    return kernel_isa;
+}
+
+template <typename precision, typename layout>
+std::size_t basic_simulation<precision, layout>::tileScratchSize() const {
+    // Two tiles with halo rows, four rows of net updates and two carry rows
+    const std::size_t tiled_size{2 * (tile_size[1] + 2) * tile_size[0] + 4 * (tile_size[0] + 1) + 2 * tile_size[0]};
+    if (kernel != sweep_kernel::temporal) { return tiled_size; }
+
+    // Three cell arrays of a tile with one halo cell per timestep on each side, four rows of net updates and two carry
+    // rows. The temporal kernel falls back to the tiled one, so it needs enough for both.
+    const std::size_t width{tile_size[0] + 2 * time_block_steps};
+    const std::size_t height{tile_size[1] + 2 * time_block_steps};
+    return std::max<std::size_t>(tiled_size, 3 * width * height + 4 * (width + 1) + 2 * width);
+}
+
+template <typename precision, typename layout>
+std::array<std::size_t, 2> basic_simulation<precision, layout>::selectTileSize(const std::array<std::size_t, 2> &num_cells) {
+    // Size of the L2 cache, if the system can tell
+    const long cache_size{sysconf(_SC_LEVEL2_CACHE_SIZE)};
+    const std::size_t l2_bytes{cache_size > 0 ? static_cast<std::size_t>(cache_size) : 1024 * 1024};
+
+    // Rows should be long enough for whole batches, but not so long that only a few of them fit
+    const std::size_t width{std::min<std::size_t>(num_cells[0], 32 * solver_batch_size)};
+
+    // Per cell the tile holds h and hu after the x sweep and streams b, h, hu, hv in and h, hu, hv out. Use half of
+    // the cache and leave the rest to the hardware.
+    const std::size_t height{l2_bytes / 2 / ((5 * sizeof(real) + 4 * sizeof(storage)) * width)};
+    return {width, std::min<std::size_t>(std::max<std::size_t>(height, 8), num_cells[1])};
+}
+
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::placeThreads(const int &num_threads, const bool &bind_threads) {
+    omp_set_num_threads(num_threads);
+    if (!bind_threads) { return; }
+
+    // CPUs the process may run on
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        throw std::runtime_error("Could not get the CPUs of the process!");
+    }
+    std::vector<int> cpus;
+    for (int cpu{0}; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) { cpus.push_back(cpu); }
+    }
+
+    // Thread i takes CPU i. Teams of the same size reuse their threads, so later parallel regions keep the binding.
+    bool failed{false};
+#pragma omp parallel default(none) shared(cpus) reduction(|| : failed)
+    {
+        cpu_set_t own;
+        CPU_ZERO(&own);
+        CPU_SET(cpus[static_cast<std::size_t>(omp_get_thread_num()) % cpus.size()], &own);
+        failed = sched_setaffinity(0, sizeof(own), &own) != 0;
+    }
+    if (failed) { throw std::runtime_error("Could not bind threads to CPUs!"); }
+}
+
+template <typename precision, typename layout>
+std::vector<std::size_t> basic_simulation<precision, layout>::splitRows(const scenario &scen,
+                                                                        const std::array<float, 2> &origin,
+                                                                        const std::array<float, 2> &cell_size,
+                                                                        const std::array<std::size_t, 2> &num_cells) {
+    // Every row costs a bit, even without wet cells. Blocks of rows are sampled into buffers of their thread.
+    constexpr std::size_t block_rows{64};
+    std::vector<std::size_t> row_work(num_cells[1] + 2, 1);
+    std::exception_ptr error;
+#pragma omp parallel default(none) shared(scen, origin, cell_size, num_cells, row_work, error)
+    {
+        std::vector<float> b_rows(block_rows * num_cells[0]);
+        std::vector<float> h_rows(block_rows * num_cells[0]);
+#pragma omp for schedule(static)
+        for (std::size_t first = 0; first < num_cells[1]; first += block_rows) {
+            // Scenarios may throw, which must not leave the parallel region
+            try {
+                const std::size_t end{std::min(first + block_rows, num_cells[1])};
+                scen.sample_rows(origin, cell_size, num_cells, {first, end}, b_rows.data(), h_rows.data());
+                for (std::size_t y{first}; y < end; ++y) {
+                    const auto row{b_rows.begin() + static_cast<std::ptrdiff_t>((y - first) * num_cells[0])};
+                    row_work[y + 1] += static_cast<std::size_t>(
+                            std::count_if(row, row + static_cast<std::ptrdiff_t>(num_cells[0]),
+                                          [](const float &value) { return value < 0.F; }));
+                }
+            } catch (...) {
+#pragma omp critical
+                error = std::current_exception();
             }
+        }
+    }
+    if (error) { std::rethrow_exception(error); }
+
+    // Ghost rows copy the bathymetry next to them
+    row_work[0] = row_work[1];
+    row_work[num_cells[1] + 1] = row_work[num_cells[1]];
+    const std::size_t total_work{std::accumulate(row_work.begin(), row_work.end(), std::size_t{0})};
+    const std::size_t num_chunks{4 * static_cast<std::size_t>(omp_get_max_threads())};
+    std::vector<std::size_t> row_chunks{0};
+    std::size_t work{0};
+    for (std::size_t y{0}; y < num_cells[1] + 2; ++y) {
+        work += row_work[y];
+        if (work * num_chunks >= total_work * row_chunks.size() && y + 1 < num_cells[1] + 2) {
+            row_chunks.push_back(y + 1);
+        }
+    }
+    row_chunks.push_back(num_cells[1] + 2);
+    return row_chunks;
+}
 
+template <typename precision, typename layout>
+auto basic_simulation<precision, layout>::sampleCells(const scenario &scen,
+                                                      const std::array<float, 2> &origin,
+                                                      const std::array<float, 2> &cell_size,
+                                                      const std::array<std::size_t, 2> &num_cells,
+                                                      const std::vector<std::size_t> &row_chunks) -> cells {
+    std::exception_ptr error;
+    cells sampled{num_cells[0], num_cells[1] + 2, row_chunks,
+                  [&](cells &target, const std::size_t &first, const std::size_t &end) {
+                      // Scenarios may throw, which must not leave the parallel region
+                      try {
+                          // Rows 1 to num_cells[1] hold the grid, the ghost rows sample the row next to them again
+                          const std::size_t first_inner{std::max<std::size_t>(first, 1)};
+                          const std::size_t end_inner{std::min(end, num_cells[1] + 1)};
+                          if (first == 0) { sampleRows(scen, origin, cell_size, num_cells, {0, 1}, 0, target); }
+                          if (first_inner < end_inner) {
+                              sampleRows(scen, origin, cell_size, num_cells, {first_inner - 1, end_inner - 1},
+                                         first_inner, target);
+                          }
+                          if (end == num_cells[1] + 2) {
+                              sampleRows(scen, origin, cell_size, num_cells, {num_cells[1] - 1, num_cells[1]},
+                                         num_cells[1] + 1, target);
+                          }
 
+                          // Still water, ghost rows start dry
+                          const auto h_cells{target.h()};
+                          const auto hu_cells{target.hu()};
+                          const auto hv_cells{target.hv()};
+                          for (std::size_t y{first}; y < end; ++y) {
+                              const bool ghost{y == 0 || y == num_cells[1] + 1};
+                              for (std::size_t cell{y * num_cells[0]}; cell < (y + 1) * num_cells[0]; ++cell) {
+                                  if (ghost) { h_cells[cell] = real{}; }
+                                  hu_cells[cell] = storage{};
+                                  hv_cells[cell] = storage{};
+                              }
+                          }
+                      } catch (...) {
+#pragma omp critical
+                          error = std::current_exception();
+                      }
+                  }};
+    if (error) { std::rethrow_exception(error); }
+    return sampled;
+}
+
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::sampleRows(const scenario &scen,
+                                                     const std::array<float, 2> &origin,
+                                                     const std::array<float, 2> &cell_size,
+                                                     const std::array<std::size_t, 2> &num_cells,
+                                                     const std::array<std::size_t, 2> &rows,
+                                                     const std::size_t &first_row,
+                                                     cells &target) {
+    const std::size_t first_cell{first_row * num_cells[0]};
+    if constexpr (std::is_same_v<typename cells::b_view, float *>) {
+        // Plain float arrays are written right away
+        scen.sample_rows(origin, cell_size, num_cells, rows, target.b() + first_cell, target.h() + first_cell);
+    } else {
+        std::vector<float> b_rows((rows[1] - rows[0]) * num_cells[0]);
+        std::vector<float> h_rows((rows[1] - rows[0]) * num_cells[0]);
+        scen.sample_rows(origin, cell_size, num_cells, rows, b_rows.data(), h_rows.data());
+        const auto b_cells{target.b()};
+        const auto h_cells{target.h()};
+        for (std::size_t i{0}; i < b_rows.size(); ++i) {
+            b_cells[first_cell + i] = b_rows[i];
+            h_cells[first_cell + i] = h_rows[i];
         }
     }
+}
 
-    // Y Sweep
-#pragma omp parallel for collapse(2) schedule(static) default(none) shared(h_updates_neg, hu_updates_neg, h_updates_pos, hu_updates_pos)
-    for (std::size_t y = 0; y <= num_cells[1]; ++y) {
-        for (std::size_t x = 0; x < num_cells[0]; ++x) {
-            const std::size_t index_b{y * num_cells[0] + x};
-            const std::size_t index_t{index_b + num_cells[0]};
-            // Set up input for solver
-            std::array<float, 6> in{};
-            if (b[index_b] >= 0.F && b[index_t] >= 0.F) { // Both cells dry
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::buildWetSpans() {
+    // Wet cells of each row, ghost rows included
+    wet_span_rows.push_back(0);
+    for (std::size_t y{0}; y < num_cells[1] + 2; ++y) {
+        const std::size_t row{y * num_cells[0]};
+        for (std::size_t x{0}; x < num_cells[0];) {
+            if (b[row + x] >= 0.F) {
+                ++x;
                 continue;
-            } else if (b[index_b] >= 0.F) { // Bottom cell dry
-                in[3] = b[index_t];
-                in[4] = h[index_t];
-                in[5] = hv[index_t];
-                in[0] = in[3];
-                in[1] = in[4];
-                in[2] = -in[5];
-            } else if (b[index_t] >= 0.F) { // Top cell dry
-                in[0] = b[index_b];
-                in[1] = h[index_b];
-                in[2] = hv[index_b];
-                in[3] = in[0];
-                in[4] = in[1];
-                in[5] = -in[2];
-            } else { // Both cells wet
-                in[0] = b[index_b];
-                in[1] = h[index_b];
-                in[2] = hv[index_b];
-                in[3] = b[index_t];
-                in[4] = h[index_t];
-                in[5] = hv[index_t];
             }
+            const std::size_t begin{row + x};
+            while (x < num_cells[0] && b[row + x] < 0.F) { ++x; }
+            wet_spans.push_back({begin, row + x});
+        }
+        wet_span_rows.push_back(wet_spans.size());
+    }
 
-            // Run solver
-            std::array<float, 5> result{solve(in)};
-
-            // Store results
-            h_updates_neg[index_b] = result[0];
-            hu_updates_neg[index_b] = result[1];
-            h_updates_pos[index_b] = result[2];
-            hu_updates_pos[index_b] = result[3];
+    // Rows of edges in y direction need solving where the cell below or above is wet
+    edge_span_rows.push_back(0);
+    for (std::size_t y{0}; y <= num_cells[1]; ++y) {
+        const std::size_t row{y * num_cells[0]};
+        for (std::size_t x{0}; x < num_cells[0];) {
+            if (b[row + x] >= 0.F && b[row + num_cells[0] + x] >= 0.F) {
+                ++x;
+                continue;
+            }
+            const std::size_t begin{row + x};
+            while (x < num_cells[0] && (b[row + x] < 0.F || b[row + num_cells[0] + x] < 0.F)) { ++x; }
+            edge_spans.push_back({begin, row + x});
         }
+        edge_span_rows.push_back(edge_spans.size());
     }
+}
 
-    // Apply updates
-#pragma omp parallel for collapse(2) schedule(static) default(none) shared(h_updates_neg, hu_updates_neg, h_updates_pos, hu_updates_pos, timestep, error_happened)
-    for (std::size_t y = 1; y <= num_cells[1]; ++y) {
-        for (std::size_t x = 0; x < num_cells[0]; ++x) {
-            const std::size_t index{y * num_cells[0] + x};
-            if (b[index] < 0.F) {
-                h[index] -= timestep / cell_size[1] * (h_updates_pos[index - num_cells[0]] + h_updates_neg[index]);
-                hv[index] -= timestep / cell_size[1] * (hu_updates_pos[index - num_cells[0]] + hu_updates_neg[index]);
-                if (h[y * num_cells[0] + x] <= 0.F) { error_happened = true; }
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::buildWetTiles() {
+    num_tiles = {(num_cells[0] + tile_size[0] - 1) / tile_size[0], (num_cells[1] + tile_size[1] - 1) / tile_size[1]};
+    for (std::size_t tile{0}; tile < num_tiles[0] * num_tiles[1]; ++tile) {
+        const auto [start, end] = tileBounds(tile);
+        bool wet{false};
+        for (std::size_t y{start[1]}; y < end[1] && !wet; ++y) {
+            for (std::size_t x{start[0]}; x < end[0] && !wet; ++x) {
+                wet = b[y * num_cells[0] + x] < 0.F;
             }
+        }
+        if (wet) { wet_tiles.push_back(tile); }
+    }
+
+    // At most all wet tiles are active, so the timesteps never grow the list
+    active_tiles.reserve(wet_tiles.size());
+
+    // At first all water counts as moving
+    tile_moving.assign(num_tiles[0] * num_tiles[1], true);
+    tile_moving_next.assign(num_tiles[0] * num_tiles[1], false);
+    tile_wave_speeds.assign(num_tiles[0] * num_tiles[1], 0.F);
+}
+
+template <typename precision, typename layout>
+std::array<std::array<std::size_t, 2>, 2> basic_simulation<precision, layout>::tileBounds(const std::size_t &tile) const {
+    // Tiles cover the inner rows 1 to num_cells[1]
+    const std::array<std::size_t, 2> start{tile % num_tiles[0] * tile_size[0], 1 + tile / num_tiles[0] * tile_size[1]};
+    const std::array<std::size_t, 2> end{std::min<std::size_t>(start[0] + tile_size[0], num_cells[0]),
+                                         std::min<std::size_t>(start[1] + tile_size[1], num_cells[1] + 1)};
+    return {start, end};
+}
+
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::updateActiveTiles(const std::size_t &steps) {
+    // Tiles that moving water could reach within the given number of steps
+    const std::size_t reach_x{(steps + tile_size[0] - 1) / tile_size[0]};
+    const std::size_t reach_y{(steps + tile_size[1] - 1) / tile_size[1]};
 
+    active_tiles.clear();
+    for (const auto &tile : wet_tiles) {
+        const std::size_t tile_x{tile % num_tiles[0]};
+        const std::size_t tile_y{tile / num_tiles[0]};
+        bool active{false};
+        for (std::size_t y{tile_y - std::min(tile_y, reach_y)}; y <= std::min(tile_y + reach_y, num_tiles[1] - 1) && !active;
+             ++y) {
+            for (std::size_t x{tile_x - std::min(tile_x, reach_x)}; x <= std::min(tile_x + reach_x, num_tiles[0] - 1) &&
+                                                                    !active; ++x) {
+                active = tile_moving[y * num_tiles[0] + x];
+            }
         }
+        if (active) { active_tiles.push_back(tile); }
     }
 
-    // Update time
-    time += timestep;
+    // Skipped tiles stay at rest
+    std::fill(tile_moving_next.begin(), tile_moving_next.end(), false);
 }
 
-void simulation::abort() {
-    stop = true;
+template <typename precision, typename layout>
+void basic_simulation<precision, layout>::buildEdgeTables() {
+    // Edges in x direction, edge x of row y lies left of cell x and has index y * (num_cells[0] + 1) + x. Border edges
+    // are solved separately and stay dry.
+    x_edges = edge_table<real>{(num_cells[0] + 1) * (num_cells[1] + 2)};
+    for (std::size_t y{0}; y < num_cells[1] + 2; ++y) {
+        const std::size_t row{y * num_cells[0]};
+        for (std::size_t x{1}; x < num_cells[0]; ++x) {
+            x_edges.set(row + y + x, b[row + x - 1], b[row + x]);
+        }
+    }
+
+    // Edges in y direction, edge x of row y lies below cell x of row y + 1 and has the index of the cell below it
+    y_edges = edge_table<real>{num_cells[0] * (num_cells[1] + 1)};
+    for (std::size_t index{0}; index < num_cells[0] * (num_cells[1] + 1); ++index) {
+        y_edges.set(index, b[index], b[index + num_cells[0]]);
+    }
 }
+
+template class basic_simulation<single_precision>;
+template class basic_simulation<double_precision>;
+template class basic_simulation<bfloat16_storage>;
+template class basic_simulation<single_precision, aosoa16_layout>;
+template class basic_simulation<single_precision, morton8_layout>;
+#ifdef __FLT16_MAX__
+template class basic_simulation<half_storage>;
+#endif
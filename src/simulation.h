@@ -10,12 +10,21 @@
 #include <stdexcept>
 #include <thread>
 #include <vector>*/
+#include "boundary.h"
 #include "gui.h"
+#include "isa.h"
+#include "layout.h"
+#include "precision.h"
 #include <string>
 #include <cstddef>
+#include <limits>
+#include <numeric>
 #include "solver.h"
+#include "worker.h"
+#include "workspace.h"
 #include "writer.h"
 #include <omp.h>
+#include <unistd.h>
 
 /** Options regarding the creation of output */
 struct output_options {
@@ -38,6 +47,18 @@ struct output_options {
   Gui& gui;
 };
 
+/** Ways of executing the two sweeps of a timestep */
+enum class sweep_kernel {
+  /** Each sweep stores its net updates in the workspace, a second pass applies them */
+  split,
+  /** Each sweep applies its net updates right away */
+  fused,
+  /** Both sweeps run on one cache sized tile after another */
+  tiled,
+  /** Like tiled, but each tile is advanced by several timesteps of one fixed size before moving on */
+  temporal
+};
+
 /** Simulation parameters */
 struct sim_options {
   /** Number of cells in x and y direction */
@@ -51,45 +72,498 @@ struct sim_options {
 
   /** Maximum amount of threads to be used by OpenMP */
   const int num_threads;
+
+  /** How the sweeps are executed */
+  const sweep_kernel kernel;
+
+  /** Number of cells per tile in x and y direction for the tiled kernels (0 = choose automatically) */
+  const std::array<std::size_t, 2> tile_size;
+
+  /** Number of timesteps the temporal kernel advances each tile by (0 = choose automatically) */
+  const std::size_t time_block_steps;
+
+  /** Whether the split kernel computes velocities and square roots of the heights once per cell before each sweep */
+  const bool precompute_cell_terms;
+
+  /** Instruction set the kernels run with */
+  const instruction_set kernel_isa;
+
+  /**
+   * Whether each OpenMP thread is bound to its own CPU, so it stays next to the memory it touched first. Threads take
+   * the CPUs the process may run on in order, which fills one socket after another on usual numberings.
+   */
+  const bool bind_threads;
+
+  /** Part of the scenario to simulate, the whole scenario if empty */
+  const region region_of_interest;
+
+  /** Stops the simulation once canceled, e.g. by the GUI while another thread runs it */
+  const cancel_token cancel;
 };
 
-/** Simulates a scenario using dimensional splitting and a f-wave solver. */
-class simulation {
+/**
+ * Simulates a scenario using dimensional splitting and a f-wave solver.
+ * @tparam precision Precision policy, see precision.h
+ * @tparam layout Layout of the cells in memory, see layout.h
+ */
+template <typename precision, typename layout = soa_layout>
+class basic_simulation {
+  using real = typename precision::compute;
+  using storage = typename precision::storage;
+  using cells = typename layout::template cells<real, storage>;
+
   const std::array<std::size_t, 2> num_cells;
   const std::array<float, 2> cell_size;
   const std::array<float, 2> origin;
   const bool reflective_bounds;
-  const std::vector<float> b;
-  std::vector<float> h;
-  std::vector<float> hu;
-  std::vector<float> hv;
+
+  /**
+   * First row of each chunk of rows with about the same number of wet cells, followed by the number of rows. Declared
+   * before the cells, which are filled by chunk.
+   */
+  const std::vector<std::size_t> row_chunks;
+
+  /** Bathymetry, heights and momenta of all cells */
+  cells state;
+
+  /** Quantities of the current cells, indexed by cell numbered row by row. Views into state or state_next. */
+  typename cells::b_view b;
+  typename cells::h_view h;
+  typename cells::hu_view hu;
+  typename cells::hv_view hv;
   float time;
   const float duration;
-  bool stop{false};
-
-  simulation(const std::array<std::size_t, 2>& num_cells,
-             const std::array<float, 2>& cell_size,
-             const std::array<float, 2>& origin,
-             const bool& reflective_bounds,
-             const std::vector<float>& b,
-             const std::vector<float>& h,
-             const std::vector<float>& hu,
-             const std::vector<float>& hv,
-             const float& time,
-             const float& duration,
-             const int& num_threads);
-
-  /** Compute current time step */
+
+  /** Checked once per timestep, shared with sim_options::cancel */
+  const cancel_token stop;
+  const sweep_kernel kernel;
+  const std::array<std::size_t, 2> tile_size;
+  const std::size_t time_block_steps;
+  const bool precompute_cell_terms;
+  const instruction_set kernel_isa;
+  const int num_threads;
+  const bool bind_threads;
+
+  /** Timesteps per block of the temporal kernel, if the options leave it open */
+  static constexpr std::size_t default_time_block_steps{4};
+
+  /** Factor by which waves may speed up during a block of the temporal kernel before it has to be redone */
+  static constexpr float time_block_speed_margin{1.25F};
+
+  /** Rows of net updates each chunk of rows needs during a fused y sweep, see fused_updates */
+  static constexpr std::size_t fused_update_rows{8};
+
+  /** Index standing for no cell */
+  static constexpr std::size_t no_cell{std::numeric_limits<std::size_t>::max()};
+
+  /** Scratch memory for net updates, allocated once in create */
+  workspace<real> scratch;
+  real* h_updates_neg;
+  real* h_updates_pos;
+  real* hu_updates_neg;
+  real* hu_updates_pos;
+
+  /** Net updates of the fused y sweep, fused_update_rows rows per chunk of rows: downward going updates of the current
+   * row of edges, upward going updates of the current and the previous row of edges, and downward going updates of
+   * the row of edges above the chunk, which the next chunk solves */
+  real* fused_updates;
+
+  /** Velocity in the direction of the current sweep and square root of the height of every cell, see
+   * precompute_cell_terms */
+  real* cell_velocity;
+  real* cell_sqrt_h;
+
+  /** Classes and bathymetry differences of all edges in x and y direction, indexed like the net updates */
+  edge_table<real> x_edges;
+  edge_table<real> y_edges;
+
+  /** Wet cells of each row as ranges [begin, end) of cell indices, for rows 0 to num_cells[1] + 1 */
+  std::vector<std::array<std::size_t, 2>> wet_spans;
+
+  /** Index of the first span of each row in wet_spans, followed by the number of spans */
+  std::vector<std::size_t> wet_span_rows;
+
+  /** Like wet_spans, for the rows of edges in y direction: cells with a wet neighbour below or above the edge */
+  std::vector<std::array<std::size_t, 2>> edge_spans;
+
+  /** Index of the first span of each row of edges in edge_spans, followed by the number of spans */
+  std::vector<std::size_t> edge_span_rows;
+
+  /** Number of tiles in x and y direction */
+  std::array<std::size_t, 2> num_tiles{0, 0};
+
+  /** Tiles containing wet cells, numbered row by row */
+  std::vector<std::size_t> wet_tiles;
+
+  /** Tiles processed by the current step, wet tiles with moving water nearby */
+  std::vector<std::size_t> active_tiles;
+
+  /**
+   * Whether any net updates of a tile didn't cancel out during the last step, for the current and the next step.
+   * char instead of bool, so threads can write their own tiles.
+   */
+  std::vector<char> tile_moving;
+  std::vector<char> tile_moving_next;
+
+  /** Maximum wave speed in x direction at each tile, kept for tiles at rest */
+  std::vector<real> tile_wave_speeds;
+
+  /** Scratch memory of each thread for the tiled kernel */
+  std::vector<real*> tile_scratch;
+
+  /** What the threads of the team have to agree on during a timestep, see reduceTeam */
+  struct team_result {
+    /** Maximum wave speed in x direction */
+    real max_wave_speed;
+
+    /** Whether a negative water height or an invalid cell occurred */
+    bool failed;
+  };
+
+  /** Partial results of one thread, on a cache line of its own */
+  struct alignas(64) team_slot {
+    /** Results of the last two calls of reduceTeam, used in turns */
+    std::array<team_result, 2> results;
+
+    /** Which of the results the last call used */
+    std::size_t turn{0};
+
+    /** First cell the thread found without positive water height, see recordFailure */
+    std::size_t failed_cell{no_cell};
+
+    /** Sweep of the timestep failed_cell was found in, 0 for x and 1 for y */
+    std::size_t failed_sweep{0};
+
+    /** Allocations of the thread during the timesteps of the last run, see heap_allocations */
+    std::size_t allocations{0};
+  };
+
+  /** Partial results of each thread of the team running the timesteps */
+  std::vector<team_slot> team_slots;
+
+  /** Second set of cells for the tiled kernel, tiles read the current cells and write these */
+  cells state_next;
+  typename cells::b_view b_next;
+  typename cells::h_view h_next;
+  typename cells::hu_view hu_next;
+  typename cells::hv_view hv_next;
+
+  /**
+   * Ghost row update for the boundary condition and instruction set, chosen once in the constructor. Like all kernels
+   * it is called by every thread of the team in run, which share its loops.
+   */
+  void (basic_simulation::*update_ghost_rows)();
+
+  /**
+   * Sweeps of the chosen kernel for the boundary condition and instruction set, chosen once in the constructor. Every
+   * thread of the team gets the same timestep size and error flag.
+   */
+  real (basic_simulation::*compute_sweeps)(bool&);
+
+  basic_simulation(const std::array<std::size_t, 2>& num_cells,
+                   const std::array<float, 2>& cell_size,
+                   const std::array<float, 2>& origin,
+                   const bool& reflective_bounds,
+                   const scenario& scen,
+                   const float& time,
+                   const float& duration,
+                   const int& num_threads,
+                   const sweep_kernel& kernel,
+                   const std::array<std::size_t, 2>& tile_size,
+                   const std::size_t& time_block_steps,
+                   const bool& precompute_cell_terms,
+                   const instruction_set& kernel_isa,
+                   const bool& bind_threads,
+                   const cancel_token& cancel);
+
+  /**
+   * Points update_ghost_rows and compute_sweeps at the instantiations for a boundary condition and an instruction set,
+   * so timesteps don't check them per cell. Defined in kernels.cpp, which is compiled once per instruction set.
+   */
+  template <typename boundary, typename isa>
+  void selectKernels();
+
+  /** Calls selectKernels for the boundary condition of this simulation */
+  template <typename isa>
+  void selectBoundaryKernels();
+
+  /**
+   * Resolves the instruction set of the options. Automatic takes the environment variable SWE_ISA (generic, sse42,
+   * avx2 or avx512) if set, or else the best instruction set of the CPU that kernels were compiled for.
+   * @param requested Instruction set of the options
+   * @return Instruction set the kernels run with
+   */
+  static instruction_set selectInstructionSet(const instruction_set& requested);
+
+  /**
+   * Sets the number of OpenMP threads of the calling thread and binds them to CPUs if asked to. Thread counts and
+   * bindings belong to the thread starting parallel regions, so create and run both call this.
+   * @param num_threads Number of threads
+   * @param bind_threads Whether to bind each thread to its own CPU, see sim_options::bind_threads
+   */
+  static void placeThreads(const int& num_threads, const bool& bind_threads);
+
+  /**
+   * Splits the rows into chunks of about the same work, a few per thread. Counts the wet cells of each row by sampling
+   * the scenario in parallel blocks of rows, without keeping the cells.
+   * @param scen Scenario to simulate
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param cell_size Size of the cells in x and y direction
+   * @param num_cells Number of cells in x and y direction
+   * @return First row of each chunk, followed by the number of rows
+   */
+  static std::vector<std::size_t> splitRows(const scenario& scen,
+                                            const std::array<float, 2>& origin,
+                                            const std::array<float, 2>& cell_size,
+                                            const std::array<std::size_t, 2>& num_cells);
+
+  /**
+   * Samples a scenario right into the cells, each chunk of rows by the thread that will compute it
+   * @param scen Scenario to simulate
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param cell_size Size of the cells in x and y direction
+   * @param num_cells Number of cells in x and y direction
+   * @param row_chunks Chunks of rows of the sweeps, see splitRows
+   * @return Cells with the sampled bathymetry and heights, still water and ghost rows copying the bathymetry next to
+   * them
+   */
+  static cells sampleCells(const scenario& scen,
+                           const std::array<float, 2>& origin,
+                           const std::array<float, 2>& cell_size,
+                           const std::array<std::size_t, 2>& num_cells,
+                           const std::vector<std::size_t>& row_chunks);
+
+  /**
+   * Samples rows of a scenario into rows of cells, see sampleCells
+   * @param scen Scenario to simulate
+   * @param origin Origin (i.e. bottom left) position of the grid
+   * @param cell_size Size of the cells in x and y direction
+   * @param num_cells Number of cells in x and y direction
+   * @param rows First row and one past the last row of the scenario's grid to sample
+   * @param first_row Row of the cells the first sampled row goes to
+   * @param target Cells to write
+   */
+  static void sampleRows(const scenario& scen,
+                         const std::array<float, 2>& origin,
+                         const std::array<float, 2>& cell_size,
+                         const std::array<std::size_t, 2>& num_cells,
+                         const std::array<std::size_t, 2>& rows,
+                         const std::size_t& first_row,
+                         cells& target);
+
+  /** Finds the wet spans of all rows */
+  void buildWetSpans();
+
+  /** Classifies all inner edges */
+  void buildEdgeTables();
+
+  /** Finds the tiles containing wet cells */
+  void buildWetTiles();
+
+  /**
+   * Cells covered by a tile
+   * @param tile Number of the tile, counted row by row
+   * @return First cell and one past the last cell in x and y direction
+   */
+  [[nodiscard]] std::array<std::array<std::size_t, 2>, 2> tileBounds(const std::size_t& tile) const;
+
+  /**
+   * Collects the wet tiles that moving water can reach. A tile at rest with all tiles around it at rest gets the
+   * same inputs as in the last step, so its net updates cancel out again.
+   * @param steps Number of steps until the next update, waves travel at most one cell per step
+   */
+  void updateActiveTiles(const std::size_t& steps);
+
+  /**
+   * Maximum wave speed in x direction, solving only active tiles
+   * @return Maximum wave speed of all tiles, the same in every thread
+   */
+  template <typename boundary, typename isa>
+  real computeTileWaveSpeeds();
+
+  /**
+   * Computes velocity and square root of the height of all wet cells for the next sweep. Each thread does the chunks of
+   * rows it sweeps and doesn't wait for the others.
+   * @param momentum Momentum in the direction of the sweep
+   */
+  template <typename isa, typename momenta>
+  void computeCellTerms(const momenta& momentum);
+
+  /**
+   * Combines the partial results of all threads of the team. Has to be called by all of them, like a barrier.
+   * @param own Partial result of the calling thread
+   * @return Maximum wave speed and whether any thread failed
+   */
+  team_result reduceTeam(const team_result& own);
+
+  /**
+   * Compute current time step together with the other threads of the team, thread 0 advances the time. Ghost rows are
+   * updated for the next timestep at the end, without waiting for the other threads.
+   * @param error_happened Set to true, if a negative water height occurred
+   */
   void computeTimestep(bool& error_happened);
 
+  /**
+   * Names the cell without positive water height the kernels found after a timestep failed
+   * @return Error message with the cell in x and y direction and the time
+   */
+  [[nodiscard]] std::string describeError() const;
+
+  /**
+   * Remembers the first wet cell without positive water height among some cells for describeError. Kernels call it
+   * right after a solver saw invalid cells or an update made the height of a cell non-positive, before later updates
+   * spread the failure to the neighbours. Does nothing once the calling thread found a cell.
+   * @param values Water heights of the cells, e.g. the grid or the copy of a tile
+   * @param first_value Index of the first cell within values
+   * @param first_cell Index of the first cell within the grid
+   * @param count Number of cells
+   * @param sweep Sweep of the timestep, 0 for x and 1 for y
+   */
+  template <typename heights>
+  void recordFailure(const heights& values, const std::size_t& first_value, const std::size_t& first_cell,
+                     const std::size_t& count, const std::size_t& sweep);
+
+  /** Copy boundary cells into ghost rows. Threads don't wait for each other afterwards. */
+  template <typename boundary, typename isa>
+  void updateGhostRows();
+
+  /**
+   * Run both sweeps, storing net updates in the workspace before applying them
+   * @param error_happened Set to true, if a negative water height occurred
+   * @return Timestep size
+   */
+  template <typename boundary, typename isa>
+  real computeSweeps(bool& error_happened);
+
+  /**
+   * Run both sweeps, applying net updates right away
+   * @param error_happened Set to true, if a negative water height occurred
+   * @return Timestep size
+   */
+  template <typename boundary, typename isa>
+  real computeFusedSweeps(bool& error_happened);
+
+  /**
+   * Solves the edges of a row of edges in y direction that have a wet cell next to them, for the fused kernel
+   * @param y Row of edges, between rows y and y + 1
+   * @param h_neg Output net updates for height of the cells below, one per column
+   * @param hv_neg Output net updates for momentum of the cells below
+   * @param h_pos Output net updates for height of the cells above
+   * @param hv_pos Output net updates for momentum of the cells above
+   * @param invalid_lanes See solve_batch
+   */
+  template <typename isa>
+  void solveFusedEdgeRow(const std::size_t& y, real* h_neg, real* hv_neg, real* h_pos, real* hv_pos,
+                         std::uint32_t& invalid_lanes);
+
+  /**
+   * Finds the maximum wave speed of the x sweep without modifying any cells
+   * @return Maximum absolute wave speed within the rows of the calling thread, see reduceTeam
+   */
+  template <typename boundary, typename isa>
+  [[nodiscard]] real computeMaxWaveSpeed() const;
+
+  /**
+   * Run both sweeps tile by tile, writing the new cells into the second set of cells
+   * @param error_happened Set to true, if a negative water height occurred
+   * @return Timestep size
+   */
+  template <typename boundary, typename isa>
+  real computeTiledSweeps(bool& error_happened);
+
+  /**
+   * Run both sweeps on one tile
+   * @param start First cell of the tile in x and y direction
+   * @param end One past the last cell of the tile in x and y direction
+   * @param timestep_x Timestep size divided by cell size in x direction
+   * @param timestep_y Timestep size divided by cell size in y direction
+   * @param tile Scratch memory of the calling thread
+   * @param moving Set to true, if any cell of the tile changed
+   * @return true, if a negative water height occurred
+   */
+  template <typename boundary, typename isa>
+  bool sweepTile(const std::array<std::size_t, 2>& start,
+                 const std::array<std::size_t, 2>& end,
+                 const real& timestep_x,
+                 const real& timestep_y,
+                 real* tile,
+                 bool& moving);
+
+  /**
+   * Advance all tiles by a block of timesteps of one size. The size is chosen from the current wave speeds with some
+   * room for waves speeding up. If they speed up more than that, the block is redone using the tiled kernel.
+   * @param error_happened Set to true, if a negative water height occurred
+   * @return Time passed during the block
+   */
+  template <typename boundary, typename isa>
+  real computeTemporalSweeps(bool& error_happened);
+
+  /**
+   * Advance one tile by several timesteps. The tile is copied together with one halo cell per timestep on each side,
+   * so it can be advanced without waiting for its neighbours. Halo cells near the copy's edges become wrong, but
+   * only reach the tile itself after the last timestep.
+   * @param start First cell of the tile in x and y direction
+   * @param end One past the last cell of the tile in x and y direction
+   * @param steps Number of timesteps
+   * @param timestep_x Timestep size divided by cell size in x direction
+   * @param timestep_y Timestep size divided by cell size in y direction
+   * @param tile Scratch memory of the calling thread
+   * @param max_wave_speed Raised to the fastest wave speed between cells that are still exact, infinity if any of
+   * them is not finite
+   * @param moving Set to true, if any cell of the tile changed
+   * @return true, if a negative water height occurred
+   */
+  template <typename boundary, typename isa>
+  bool sweepTileSteps(const std::array<std::size_t, 2>& start,
+                      const std::array<std::size_t, 2>& end,
+                      const std::size_t& steps,
+                      const real& timestep_x,
+                      const real& timestep_y,
+                      real* tile,
+                      real& max_wave_speed,
+                      bool& moving);
+
+  /**
+   * Size of the scratch memory one thread needs for the tiled kernels
+   * @return Number of values of the compute type
+   */
+  [[nodiscard]] std::size_t tileScratchSize() const;
+
+  /**
+   * Chooses a tile size whose working set fits into the L2 cache
+   * @param num_cells Number of cells in x and y direction
+   * @return Number of cells per tile in x and y direction
+   */
+  static std::array<std::size_t, 2> selectTileSize(const std::array<std::size_t, 2>& num_cells);
+
 public:
-  static simulation create(const scenario& scen, const sim_options& sim_opt);
+  /** Simulations own all cells, so they are moved, e.g. into the thread running them, but never copied */
+  basic_simulation(const basic_simulation&) = delete;
+  basic_simulation& operator=(const basic_simulation&) = delete;
+  basic_simulation(basic_simulation&&) = default;
+
+  static basic_simulation create(const scenario& scen, const sim_options& sim_opt);
 
   /** Starts the simulation */
   void run(output_options out_opt);
 
-  /** Stops the simulation */
+  /** Stops the simulation after the current timestep, from any thread. Cancels sim_options::cancel. */
   void abort();
+
+  /**
+   * Getter for allocations of the timesteps. Only counted in builds with SWE_COUNT_ALLOCATIONS, see heap_allocations.
+   * @return Number of allocations all threads did during the timesteps of the last run, should always be 0
+   */
+  [[nodiscard]] std::size_t get_step_allocations() const;
+
+  /**
+   * Getter for the instruction set
+   * @return Instruction set the kernels run with
+   */
+  [[nodiscard]] instruction_set get_instruction_set() const;
 };
 
+/** Simulation in single precision, used by the GUI */
+using simulation = basic_simulation<single_precision>;
+
 #endif // SIMULATION_H
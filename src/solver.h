@@ -1,19 +1,26 @@
 #ifndef SOLVER_H
 #define SOLVER_H
 
+#include "isa.h"
+#include <algorithm>
 #include <array>
 #include <cmath>
-#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
 /**
  * Calculates updates and maximum absolute wave speed.
  * @param in Array [b_l, h_l, hu_l, b_r, h_r, hu_r] b must be negative, h must be positive
+ * @param invalid Lowest bit is set, if b or h don't meet these requirements. All results are 0 then.
  * @return Array [delta_h_left, delta_hu_left, delta_h_right, delta_hu_right, max absolute wave speed]
  */
-static inline std::array<float, 5> solve(const std::array<float, 6>& in) {
+template <typename real>
+static inline SWE_TARGET std::array<real, 5> solve(const std::array<real, 6>& in, std::uint32_t& invalid) noexcept {
   // We do not support dry cells in the solver. These must be handled by the caller beforehand.
   if (!(in[0] < 0 && in[3] < 0 && in[1] > 0 && in[4] > 0)) {
-    throw std::runtime_error("Positive bathymetry and/or negative water height in solver!");
+    invalid |= 1U;
+    return {0.F, 0.F, 0.F, 0.F, 0.F};
   }
 
   // Velocity u
@@ -29,7 +36,7 @@ static inline std::array<float, 5> solve(const std::array<float, 6>& in) {
   const auto u_roe{(u_l * sqrt_h_l + u_r * sqrt_h_r) / (sqrt_h_l + sqrt_h_r)};
 
   // Gravity of Earth
-  static constexpr auto g{9.80665F};
+  static constexpr real g{static_cast<real>(9.80665)};
 
   // Square root of gravity * h^Roe
   const auto sqrt_g_h_roe{std::sqrt(g * h_roe)};
@@ -48,22 +55,22 @@ static inline std::array<float, 5> solve(const std::array<float, 6>& in) {
 
   // Inverse of the matrix of eigenvectors  |   1        1    |
   //                                        |lambda_1 lambda_2|
-  const std::array<float, 4> inverse{lambda_2 / delta_lambda,
-                                     -1.F / delta_lambda,
-                                     -lambda_1 / delta_lambda,
-                                     1.F / delta_lambda};
+  const std::array<real, 4> inverse{lambda_2 / delta_lambda,
+                                    -1.F / delta_lambda,
+                                    -lambda_1 / delta_lambda,
+                                    1.F / delta_lambda};
 
   // Flux function difference, including effects of bathymetry
-  const std::array<float, 2> delta_flux_bathy{in[5] - in[2],
-                                              in[5] * u_r - in[2] * u_l +
-                                              g * (.5F * (in[4] * in[4] - in[1] * in[1]) + (in[3] - in[0]) * h_roe)};
+  const std::array<real, 2> delta_flux_bathy{in[5] - in[2],
+                                             in[5] * u_r - in[2] * u_l +
+                                             g * (.5F * (in[4] * in[4] - in[1] * in[1]) + (in[3] - in[0]) * h_roe)};
 
   // Eigencoefficients
-  const std::array<float, 2> alpha{inverse[0] * delta_flux_bathy[0] + inverse[1] * delta_flux_bathy[1],
-                                   inverse[2] * delta_flux_bathy[0] + inverse[3] * delta_flux_bathy[1]};
+  const std::array<real, 2> alpha{inverse[0] * delta_flux_bathy[0] + inverse[1] * delta_flux_bathy[1],
+                                  inverse[2] * delta_flux_bathy[0] + inverse[3] * delta_flux_bathy[1]};
 
   // Waves
-  const std::array<float, 4> z{alpha[0], alpha[0] * lambda_1, alpha[1], alpha[1] * lambda_2};
+  const std::array<real, 4> z{alpha[0], alpha[0] * lambda_1, alpha[1], alpha[1] * lambda_2};
 
   // Return net updates and wave speed
   if (lambda_1 > 0.F) {
@@ -71,8 +78,375 @@ static inline std::array<float, 5> solve(const std::array<float, 6>& in) {
   } else if (lambda_2 < 0.F) {
     return {z[0] + z[2], z[1] + z[3], 0.F, 0.F, -lambda_1};
   } else {
-    return {z[0], z[1], z[2], z[3], std::max<float>(-lambda_1, lambda_2)};
+    return {z[0], z[1], z[2], z[3], std::max<real>(-lambda_1, lambda_2)};
   }
 }
 
+/** Maximum number of edges handled by one call to solve_batch. One AVX-512 register or two AVX2 registers of floats. */
+static constexpr std::size_t solver_batch_size{16};
+
+/** Number of edges packed into one word of an edge_table */
+static constexpr std::size_t edges_per_word{32};
+
+/** Bit of each lane of a batch within the words returned by edge_table::lanes */
+static constexpr std::array<std::uint32_t, solver_batch_size> lane_bits{
+        1U << 0U, 1U << 1U, 1U << 2U, 1U << 3U, 1U << 4U, 1U << 5U, 1U << 6U, 1U << 7U,
+        1U << 8U, 1U << 9U, 1U << 10U, 1U << 11U, 1U << 12U, 1U << 13U, 1U << 14U, 1U << 15U};
+
+/**
+ * Data of a set of edges that only depends on the bathymetry, built once before a simulation runs. The batch solvers
+ * read it instead of the bathymetry of both cells.
+ */
+template <typename real>
+struct edge_table {
+  /** One bit per edge, set if the left cell is dry. Padded by one word for the batch solvers. */
+  std::vector<std::uint32_t> dry_left;
+
+  /** One bit per edge, set if the right cell is dry. Padded by one word for the batch solvers. */
+  std::vector<std::uint32_t> dry_right;
+
+  /** Bathymetry of the right cell minus bathymetry of the left cell, 0 if any of them is dry */
+  std::vector<real> delta_b;
+
+  /**
+   * Allocates a table with all edges between two dry cells
+   * @param num_edges Number of edges
+   */
+  explicit edge_table(const std::size_t& num_edges = 0)
+          : dry_left(num_edges / edges_per_word + 2, ~std::uint32_t{0}),
+            dry_right(num_edges / edges_per_word + 2, ~std::uint32_t{0}),
+            delta_b(num_edges, 0.F) {}
+
+  /**
+   * Classifies an edge
+   * @param edge Index of the edge
+   * @param b_l Bathymetry of the left cell
+   * @param b_r Bathymetry of the right cell
+   */
+  void set(const std::size_t& edge, const real& b_l, const real& b_r) {
+    const std::uint32_t bit{std::uint32_t{1} << (edge % edges_per_word)};
+    dry_left[edge / edges_per_word] = b_l >= 0.F ? dry_left[edge / edges_per_word] | bit
+                                                 : dry_left[edge / edges_per_word] & ~bit;
+    dry_right[edge / edges_per_word] = b_r >= 0.F ? dry_right[edge / edges_per_word] | bit
+                                                  : dry_right[edge / edges_per_word] & ~bit;
+    delta_b[edge] = b_l < 0.F && b_r < 0.F ? b_r - b_l : 0.F;
+  }
+
+  /**
+   * Dry bits of a batch of edges, lane i of the batch at lane_bits[i]
+   * @param first_edge Index of the first edge of the batch
+   * @param left Output bits of dry left cells
+   * @param right Output bits of dry right cells
+   */
+  void lanes(const std::size_t& first_edge, std::uint32_t& left, std::uint32_t& right) const {
+    const std::size_t word{first_edge / edges_per_word};
+    const std::size_t shift{first_edge % edges_per_word};
+    left = static_cast<std::uint32_t>((dry_left[word] | std::uint64_t{dry_left[word + 1]} << 32U) >> shift);
+    right = static_cast<std::uint32_t>((dry_right[word] | std::uint64_t{dry_right[word + 1]} << 32U) >> shift);
+  }
+};
+
+/**
+ * Solves one lane of a batch, after dry cells have been replaced by their mirrored neighbour. Shared by the batch
+ * solvers, which inline it into their vectorized loops.
+ * @param both_dry Whether both cells are dry
+ * @param delta_b Bathymetry difference from the edge table
+ * @param h_l Water height of left cell
+ * @param hu_l Momentum of left cell
+ * @param u_l Velocity of left cell
+ * @param sqrt_h_l Square root of water height of left cell
+ * @param h_r Water height of right cell
+ * @param hu_r Momentum of right cell
+ * @param u_r Velocity of right cell
+ * @param sqrt_h_r Square root of water height of right cell
+ * @param upd_h_l Output net update for height of left cell
+ * @param upd_hu_l Output net update for momentum of left cell
+ * @param upd_h_r Output net update for height of right cell
+ * @param upd_hu_r Output net update for momentum of right cell
+ * @return Absolute wave speed of this lane
+ */
+template <typename real>
+static inline SWE_TARGET real solve_lane(const bool& both_dry, const real& delta_b,
+                                         const real& h_l, const real& hu_l, const real& u_l, const real& sqrt_h_l,
+                                         const real& h_r, const real& hu_r, const real& u_r, const real& sqrt_h_r,
+                                         real& upd_h_l, real& upd_hu_l, real& upd_h_r, real& upd_hu_r) {
+  // Every value below is computed unconditionally and only selected by masks. Conditionally evaluated floating point
+  // operations would keep the compiler from if-converting the loop.
+
+  // Gravity of Earth
+  static constexpr real g{static_cast<real>(9.80665)};
+
+  // height h^Roe and particle velocity u^Roe
+  const real h_roe{.5F * (h_l + h_r)};
+  const real u_roe{(u_l * sqrt_h_l + u_r * sqrt_h_r) / (sqrt_h_l + sqrt_h_r)};
+
+  // Square root of gravity * h^Roe
+  const real sqrt_g_h_roe{std::sqrt(g * h_roe)};
+
+  // Wave speeds, aka Roe eigenvalues
+  const real lambda_1{u_roe - sqrt_g_h_roe};
+  const real lambda_2{u_roe + sqrt_g_h_roe};
+
+  // Difference between wave speeds
+  const real delta_lambda{lambda_2 - lambda_1};
+
+  // Flux function difference, including effects of bathymetry
+  const real delta_flux_0{hu_r - hu_l};
+  const real delta_flux_1{hu_r * u_r - hu_l * u_l + g * (.5F * (h_r * h_r - h_l * h_l) + delta_b * h_roe)};
+
+  // Eigencoefficients
+  const real alpha_1{lambda_2 / delta_lambda * delta_flux_0 + -1.F / delta_lambda * delta_flux_1};
+  const real alpha_2{-lambda_1 / delta_lambda * delta_flux_0 + 1.F / delta_lambda * delta_flux_1};
+
+  // Waves and their sums
+  const real z_0{alpha_1};
+  const real z_1{alpha_1 * lambda_1};
+  const real z_2{alpha_2};
+  const real z_3{alpha_2 * lambda_2};
+  const real z_02{z_0 + z_2};
+  const real z_13{z_1 + z_3};
+
+  // Lanes without updates: both cells dry, or both cells have the same values in them (early return of solve)
+  const bool steady = (delta_b == 0.F) & (h_l == h_r) & (hu_l == hu_r);
+  const bool none = both_dry | steady;
+
+  // Distribute waves depending on their direction. lambda_1 <= lambda_2, so at most one of these masks is set.
+  const bool right_only{lambda_1 > 0.F};
+  const bool left_only{lambda_2 < 0.F};
+  const real h_l_only{right_only ? 0.F : (left_only ? z_02 : z_0)};
+  const real hu_l_only{right_only ? 0.F : (left_only ? z_13 : z_1)};
+  const real h_r_only{left_only ? 0.F : (right_only ? z_02 : z_2)};
+  const real hu_r_only{left_only ? 0.F : (right_only ? z_13 : z_3)};
+  upd_h_l = none ? 0.F : h_l_only;
+  upd_hu_l = none ? 0.F : hu_l_only;
+  upd_h_r = none ? 0.F : h_r_only;
+  upd_hu_r = none ? 0.F : hu_r_only;
+
+  // Maximum wave speed of this lane
+  const bool upstream{hu_l < 0.F};
+  const real split{-lambda_1 > lambda_2 ? -lambda_1 : lambda_2};
+  const real moving{right_only ? lambda_2 : (left_only ? -lambda_1 : split)};
+  const real resting{upstream ? -lambda_1 : lambda_2};
+  const real wet{steady ? resting : moving};
+  return both_dry ? 0.F : wet;
+}
+
+/**
+ * Calculates updates and maximum absolute wave speed for a batch of edges. Inputs and outputs are structure-of-arrays
+ * spans of length count, so lane i describes the edge between cell l[i] and cell r[i]. Unlike solve, dry cells
+ * are handled here: a dry neighbour acts as a reflecting wall and an edge between two dry cells has no updates. Which
+ * cells are dry comes from the edge table, so all cases are resolved with lane masks and the loop vectorizes
+ * (requires -fno-math-errno for sqrt). Cells are read through lanes, plain pointers or the lane views of a layout, see
+ * layout.h.
+ * @param count Number of edges in batch, at most solver_batch_size
+ * @param edges Table of the edges
+ * @param first_edge Index of the first edge of the batch in edges
+ * @param h_l Water height of left cells
+ * @param hu_l Momentum of left cells
+ * @param h_r Water height of right cells
+ * @param hu_r Momentum of right cells
+ * @param h_upd_l Output net updates for height of left cells
+ * @param hu_upd_l Output net updates for momentum of left cells
+ * @param h_upd_r Output net updates for height of right cells
+ * @param hu_upd_r Output net updates for momentum of right cells
+ * @param invalid_lanes Bits of lanes with a wet cell without positive water height are set, lane i at lane_bits[i]
+ * @return Maximum absolute wave speed within batch
+ */
+template <typename real, typename heights, typename momenta>
+static inline SWE_TARGET real solve_batch(const std::size_t& count, const edge_table<real>& edges,
+                                          const std::size_t& first_edge,
+                                          const heights h_l, const momenta hu_l, const heights h_r, const momenta hu_r,
+                                          real* __restrict h_upd_l, real* __restrict hu_upd_l,
+                                          real* __restrict h_upd_r, real* __restrict hu_upd_r,
+                                          std::uint32_t& invalid_lanes) noexcept {
+  real max_wave_speed{0.F};
+  std::uint32_t invalid{0};
+
+  // Dry cells of the batch
+  std::uint32_t dry_left{0};
+  std::uint32_t dry_right{0};
+  edges.lanes(first_edge, dry_left, dry_right);
+  const real* __restrict delta_b{&edges.delta_b[first_edge]};
+
+#pragma omp simd reduction(max : max_wave_speed) reduction(| : invalid)
+  for (std::size_t i = 0; i < count; ++i) {
+    // Load both cells of this edge
+    const real l_h{h_l[i]}, l_hu{hu_l[i]};
+    const real r_h{h_r[i]}, r_hu{hu_r[i]};
+
+    // Lane masks for dry cells
+    const bool dry_l = (dry_left & lane_bits[i]) != 0;
+    const bool dry_r = (dry_right & lane_bits[i]) != 0;
+    const bool both_dry = dry_l & dry_r;
+
+    // A dry cell mirrors its wet neighbour with reversed momentum
+    const real in_h_l{dry_l ? r_h : l_h};
+    const real in_hu_l{dry_l ? -r_hu : l_hu};
+    const real in_h_r{dry_r ? l_h : r_h};
+    const real in_hu_r{dry_r ? -l_hu : r_hu};
+
+    // Heights must be positive, unless both cells are dry
+    const bool valid = both_dry | ((in_h_l > 0.F) & (in_h_r > 0.F));
+    invalid |= valid ? 0U : lane_bits[i];
+
+    // Velocity u and square roots of the heights
+    const real u_l{in_hu_l / in_h_l};
+    const real u_r{in_hu_r / in_h_r};
+    const real sqrt_h_l{std::sqrt(in_h_l)};
+    const real sqrt_h_r{std::sqrt(in_h_r)};
+
+    const real speed{solve_lane(both_dry, delta_b[i], in_h_l, in_hu_l, u_l, sqrt_h_l, in_h_r, in_hu_r, u_r, sqrt_h_r,
+                                h_upd_l[i], hu_upd_l[i], h_upd_r[i], hu_upd_r[i])};
+    max_wave_speed = speed > max_wave_speed ? speed : max_wave_speed;
+  }
+
+  // We do not support negative water heights in wet cells, the caller decides how to report them
+  invalid_lanes |= invalid;
+  return max_wave_speed;
+}
+
+/**
+ * Same as solve_batch, but reads velocities and square roots of the heights computed once per cell, instead of
+ * computing them for both edges of every cell.
+ * @param count Number of edges in batch, at most solver_batch_size
+ * @param edges Table of the edges
+ * @param first_edge Index of the first edge of the batch in edges
+ * @param h_l Water height of left cells
+ * @param hu_l Momentum of left cells
+ * @param u_l Velocity of left cells
+ * @param sqrt_h_l Square root of water height of left cells
+ * @param h_r Water height of right cells
+ * @param hu_r Momentum of right cells
+ * @param u_r Velocity of right cells
+ * @param sqrt_h_r Square root of water height of right cells
+ * @param h_upd_l Output net updates for height of left cells
+ * @param hu_upd_l Output net updates for momentum of left cells
+ * @param h_upd_r Output net updates for height of right cells
+ * @param hu_upd_r Output net updates for momentum of right cells
+ * @param invalid_lanes Bits of lanes with a wet cell without positive water height are set, lane i at lane_bits[i]
+ * @return Maximum absolute wave speed within batch
+ */
+template <typename real, typename heights, typename momenta>
+static inline SWE_TARGET real solve_batch_precomputed(const std::size_t& count, const edge_table<real>& edges,
+                                                      const std::size_t& first_edge,
+                                                      const heights h_l, const momenta hu_l,
+                                                      const real* __restrict u_l, const real* __restrict sqrt_h_l,
+                                                      const heights h_r, const momenta hu_r,
+                                                      const real* __restrict u_r, const real* __restrict sqrt_h_r,
+                                                      real* __restrict h_upd_l, real* __restrict hu_upd_l,
+                                                      real* __restrict h_upd_r, real* __restrict hu_upd_r,
+                                                      std::uint32_t& invalid_lanes) noexcept {
+  real max_wave_speed{0.F};
+  std::uint32_t invalid{0};
+
+  // Dry cells of the batch
+  std::uint32_t dry_left{0};
+  std::uint32_t dry_right{0};
+  edges.lanes(first_edge, dry_left, dry_right);
+  const real* __restrict delta_b{&edges.delta_b[first_edge]};
+
+#pragma omp simd reduction(max : max_wave_speed) reduction(| : invalid)
+  for (std::size_t i = 0; i < count; ++i) {
+    // Load both cells of this edge
+    const real l_h{h_l[i]}, l_hu{hu_l[i]}, l_u{u_l[i]}, l_sqrt_h{sqrt_h_l[i]};
+    const real r_h{h_r[i]}, r_hu{hu_r[i]}, r_u{u_r[i]}, r_sqrt_h{sqrt_h_r[i]};
+
+    // Lane masks for dry cells, see solve_batch
+    const bool dry_l = (dry_left & lane_bits[i]) != 0;
+    const bool dry_r = (dry_right & lane_bits[i]) != 0;
+    const bool both_dry = dry_l & dry_r;
+
+    // A dry cell mirrors its wet neighbour with reversed momentum and velocity
+    const real in_h_l{dry_l ? r_h : l_h};
+    const real in_hu_l{dry_l ? -r_hu : l_hu};
+    const real in_u_l{dry_l ? -r_u : l_u};
+    const real in_sqrt_h_l{dry_l ? r_sqrt_h : l_sqrt_h};
+    const real in_h_r{dry_r ? l_h : r_h};
+    const real in_hu_r{dry_r ? -l_hu : r_hu};
+    const real in_u_r{dry_r ? -l_u : r_u};
+    const real in_sqrt_h_r{dry_r ? l_sqrt_h : r_sqrt_h};
+
+    // Heights must be positive, unless both cells are dry
+    const bool valid = both_dry | ((in_h_l > 0.F) & (in_h_r > 0.F));
+    invalid |= valid ? 0U : lane_bits[i];
+
+    const real speed{solve_lane(both_dry, delta_b[i], in_h_l, in_hu_l, in_u_l, in_sqrt_h_l,
+                                in_h_r, in_hu_r, in_u_r, in_sqrt_h_r,
+                                h_upd_l[i], hu_upd_l[i], h_upd_r[i], hu_upd_r[i])};
+    max_wave_speed = speed > max_wave_speed ? speed : max_wave_speed;
+  }
+
+  // We do not support negative water heights in wet cells, the caller decides how to report them
+  invalid_lanes |= invalid;
+  return max_wave_speed;
+}
+
+/**
+ * Calculates only the maximum absolute wave speed for a batch of edges. Gives the same result as solve_batch, but
+ * skips the eigencoefficients and net updates. Used to find the timestep before the state is modified.
+ * @param count Number of edges in batch, at most solver_batch_size
+ * @param edges Table of the edges
+ * @param first_edge Index of the first edge of the batch in edges
+ * @param h_l Water height of left cells
+ * @param hu_l Momentum of left cells
+ * @param h_r Water height of right cells
+ * @param hu_r Momentum of right cells
+ * @return Maximum absolute wave speed within batch
+ */
+template <typename real, typename heights, typename momenta>
+static inline SWE_TARGET real wave_speed_batch(const std::size_t& count, const edge_table<real>& edges,
+                                               const std::size_t& first_edge,
+                                               const heights h_l, const momenta hu_l,
+                                               const heights h_r, const momenta hu_r) {
+  // Gravity of Earth
+  static constexpr real g{static_cast<real>(9.80665)};
+
+  real max_wave_speed{0.F};
+
+  // Dry cells of the batch
+  std::uint32_t dry_left{0};
+  std::uint32_t dry_right{0};
+  edges.lanes(first_edge, dry_left, dry_right);
+  const real* __restrict delta_b{&edges.delta_b[first_edge]};
+
+#pragma omp simd reduction(max : max_wave_speed)
+  for (std::size_t i = 0; i < count; ++i) {
+    // Load both cells of this edge
+    const real l_h{h_l[i]}, l_hu{hu_l[i]};
+    const real r_h{h_r[i]}, r_hu{hu_r[i]};
+    const real in_delta_b{delta_b[i]};
+
+    // Lane masks for dry cells, see solve_batch
+    const bool dry_l = (dry_left & lane_bits[i]) != 0;
+    const bool dry_r = (dry_right & lane_bits[i]) != 0;
+    const bool both_dry = dry_l & dry_r;
+    const real in_h_l{dry_l ? r_h : l_h};
+    const real in_hu_l{dry_l ? -r_hu : l_hu};
+    const real in_h_r{dry_r ? l_h : r_h};
+    const real in_hu_r{dry_r ? -l_hu : r_hu};
+
+    // Roe eigenvalues
+    const real sqrt_h_l{std::sqrt(in_h_l)};
+    const real sqrt_h_r{std::sqrt(in_h_r)};
+    const real u_roe{(in_hu_l / in_h_l * sqrt_h_l + in_hu_r / in_h_r * sqrt_h_r) / (sqrt_h_l + sqrt_h_r)};
+    const real sqrt_g_h_roe{std::sqrt(g * (.5F * (in_h_l + in_h_r)))};
+    const real lambda_1{u_roe - sqrt_g_h_roe};
+    const real lambda_2{u_roe + sqrt_g_h_roe};
+
+    // Maximum wave speed of this lane
+    const bool steady = (in_delta_b == 0.F) & (in_h_l == in_h_r) & (in_hu_l == in_hu_r);
+    const bool right_only{lambda_1 > 0.F};
+    const bool left_only{lambda_2 < 0.F};
+    const bool upstream{in_hu_l < 0.F};
+    const real split{-lambda_1 > lambda_2 ? -lambda_1 : lambda_2};
+    const real moving{right_only ? lambda_2 : (left_only ? -lambda_1 : split)};
+    const real resting{upstream ? -lambda_1 : lambda_2};
+    const real wet{steady ? resting : moving};
+    const real speed{both_dry ? 0.F : wet};
+    max_wave_speed = speed > max_wave_speed ? speed : max_wave_speed;
+  }
+
+  return max_wave_speed;
+}
+
 #endif  // SOLVER_H
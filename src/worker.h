@@ -0,0 +1,92 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+/** Thrown by work that stopped because its cancel_token was canceled, not because it failed */
+class canceled_error : public std::runtime_error {
+public:
+  canceled_error() : std::runtime_error{"Canceled"} {}
+};
+
+/** Flag another thread sets to stop a simulation. Copies share the same flag. */
+class cancel_token {
+private:
+  std::shared_ptr<std::atomic<bool>> canceled{std::make_shared<std::atomic<bool>>(false)};
+
+public:
+  /** Asks everything holding a copy of this token to stop */
+  void cancel() const noexcept { canceled->store(true, std::memory_order_relaxed); }
+
+  /**
+   * Getter for the flag, cheap enough to check once per timestep
+   * @return Whether cancel was called on any copy of this token
+   */
+  [[nodiscard]] bool is_canceled() const noexcept { return canceled->load(std::memory_order_relaxed); }
+
+  /**
+   * Lets work without a timestep loop stop, e.g. from a progress callback of file_scenario::create
+   * @throws canceled_error If cancel was called on any copy of this token
+   */
+  void throw_if_canceled() const {
+    if (is_canceled()) { throw canceled_error{}; }
+  }
+};
+
+/**
+ * Thread setting up and running a simulation. Stops the simulation through its cancel token and joins the thread
+ * before it is replaced or destroyed, so no simulation outlives its owner.
+ */
+class simulation_worker {
+private:
+  /** Token the simulation of the thread stops on */
+  cancel_token token;
+
+  /** Thread, not joinable if no work was started */
+  std::thread thread;
+
+public:
+  simulation_worker() = default;
+
+  /**
+   * Starts a thread
+   * @param token Token the work stops on, e.g. passed to the simulation in its sim_options
+   * @param work Function setting up and running a simulation
+   */
+  template <typename function>
+  simulation_worker(cancel_token token, function&& work)
+      : token{std::move(token)}, thread{std::forward<function>(work)} {}
+
+  simulation_worker(const simulation_worker&) = delete;
+  simulation_worker& operator=(const simulation_worker&) = delete;
+
+  simulation_worker(simulation_worker&& other) noexcept : token{other.token}, thread{std::move(other.thread)} {}
+
+  simulation_worker& operator=(simulation_worker&& other) {
+    if (this != &other) {
+      stop();
+      token = other.token;
+      thread = std::move(other.thread);
+    }
+    return *this;
+  }
+
+  ~simulation_worker() { stop(); }
+
+  /** Asks the simulation to stop without waiting for it, e.g. from a GUI callback */
+  void cancel() const noexcept { token.cancel(); }
+
+  /** Asks the simulation to stop and waits for the thread to finish */
+  void stop() {
+    if (thread.joinable()) {
+      token.cancel();
+      thread.join();
+    }
+  }
+};
+
+#endif  // WORKER_H
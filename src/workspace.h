@@ -0,0 +1,95 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include "allocator.h"
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Scratch memory owned by a simulation. All arrays are carved out of one aligned grid block (see allocate_grid), which
+ * is allocated once during setup and then reused for every timestep. Contents are not cleared between uses, kernels must write every
+ * value before reading it.
+ * @tparam value Type of the array elements
+ */
+template <typename value>
+class workspace {
+public:
+  /** Alignment of the block and of every array in bytes. One cache line and one AVX-512 register. */
+  static constexpr std::size_t alignment{grid_alignment};
+
+private:
+  /** Frees the aligned block */
+  struct deleter {
+    /** Size of the block in values */
+    std::size_t size{0};
+
+    void operator()(value* ptr) const { grid_allocator<value>{}.deallocate(ptr, size); }
+  };
+
+  /** Aligned block containing all arrays */
+  std::unique_ptr<value[], deleter> block;
+
+  /** Size of block in values */
+  std::size_t capacity{0};
+
+  /** Values of block already handed out */
+  std::size_t used{0};
+
+  /**
+   * Rounds a number of values up to a multiple of the alignment.
+   * @param size Number of values
+   * @return Padded number of values
+   */
+  static constexpr std::size_t pad(const std::size_t& size) {
+    constexpr std::size_t values_per_line{alignment / sizeof(value)};
+    return (size + values_per_line - 1) / values_per_line * values_per_line;
+  }
+
+public:
+  workspace() = default;
+  workspace(const workspace&) = delete;
+  workspace& operator=(const workspace&) = delete;
+  workspace(workspace&&) noexcept = default;
+  workspace& operator=(workspace&&) noexcept = default;
+
+  /**
+   * Allocates the block. Must be called before take. Arrays handed out earlier become invalid.
+   * @param sizes Sizes in values of all arrays that will be taken from this workspace
+   */
+  void reserve(const std::vector<std::size_t>& sizes) {
+    std::size_t total{0};
+    for (const auto& size : sizes) {
+      total += pad(size);
+    }
+    if (total > capacity) {
+      block = std::unique_ptr<value[], deleter>{grid_allocator<value>{}.allocate(total), deleter{total}};
+      capacity = total;
+    }
+    used = 0;
+  }
+
+  /**
+   * Hands out the next array of the block.
+   * @param size Number of values
+   * @return Aligned array with uninitialized contents
+   */
+  value* take(const std::size_t& size) {
+    if (used + pad(size) > capacity) {
+      throw std::logic_error("Workspace too small!");
+    }
+    value* out{block.get() + used};
+    used += pad(size);
+    return out;
+  }
+
+  /**
+   * Getter for workspace size
+   * @return Size of the block in bytes
+   */
+  [[nodiscard]] std::size_t bytes() const { return capacity * sizeof(value); }
+};
+
+#endif  // WORKSPACE_H
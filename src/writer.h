@@ -5,14 +5,27 @@
 #include <cstddef>
 #include <netcdf>
 #include <string>
+#include <type_traits>
 #include <vector>
 
+#include "layout.h"
+#include "precision.h"
 #include "scenario.h"
 
 /**
  * Class for writing simulation output to a file
+ * @tparam precision Precision policy of the simulation, see precision.h
+ * @tparam layout Layout of the cells of the simulation, see layout.h
  */
+template <typename precision, typename layout = soa_layout>
 class writer {
+  using real = typename precision::compute;
+  using storage = typename precision::storage;
+  using cells = typename layout::template cells<real, storage>;
+
+  /** Type of the values in the file. NetCDF has no 16 bit floats, so anything but double is written as float. */
+  using netcdf_value = std::conditional_t<std::is_same_v<real, double>, double, float>;
+
   netCDF::NcFile file;
   netCDF::NcDim time_dim;
   netCDF::NcDim y_dim;
@@ -25,11 +38,47 @@ class writer {
   netCDF::NcVar hu_var;
   netCDF::NcVar hv_var;
   const float* time;
-  const float* h;
-  const float* hu;
-  const float* hv;
+  const typename cells::h_view& h;
+  const typename cells::hu_view& hu;
+  const typename cells::hv_view& hv;
+  /** Index of the first cell after the bottom ghost row. Views are referenced, simulations may swap them. */
+  const std::size_t first_cell;
   const std::size_t& timesteps_written;
 
+  /** One quantity of all inner cells row by row, if it can't be written from the simulation's cells directly */
+  std::vector<netcdf_value> packed;
+
+  /**
+   * NetCDF type of all variables of cells
+   * @return Double for doubles, float for everything else
+   */
+  static const netCDF::NcType& netcdfType() {
+    if constexpr (std::is_same_v<netcdf_value, double>) {
+      return netCDF::ncDouble;
+    } else {
+      return netCDF::ncFloat;
+    }
+  }
+
+  /**
+   * Inner cells of a quantity as they are written to the file. Plain arrays of a NetCDF type are written directly,
+   * anything else is converted and packed row by row first.
+   * @param quantity Quantity of all cells
+   * @return Values of the inner cells, valid until the next call
+   */
+  template <typename view>
+  const netcdf_value* pack(const view& quantity) {
+    if constexpr (std::is_same_v<view, netcdf_value*>) {
+      return quantity + first_cell;
+    } else {
+      packed.resize(x_dim.getSize() * y_dim.getSize());
+      for (std::size_t i{0}; i < packed.size(); ++i) {
+        packed[i] = static_cast<netcdf_value>(quantity[first_cell + i]);
+      }
+      return packed.data();
+    }
+  }
+
 public:
   /**
    * Create a new output file
@@ -46,9 +95,9 @@ public:
   writer(const std::string& filename,
          std::array<std::size_t, 2> num_cells,
          std::array<float, 2> origin, std::array<float, 2> cell_size,
-         const float& time, const std::vector<float>& b,
-         const std::vector<float>& h, const std::vector<float>& hu,
-         const std::vector<float>& hv,
+         const float& time, const typename cells::b_view& b,
+         const typename cells::h_view& h, const typename cells::hu_view& hu,
+         const typename cells::hv_view& hv,
          const std::size_t& timesteps_written)
           : file{filename, netCDF::NcFile::replace, netCDF::NcFile::nc4},
             time_dim{file.addDim("time")},
@@ -57,14 +106,15 @@ public:
             time_var{file.addVar("time", netCDF::ncFloat, time_dim)},
             y_var{file.addVar("y", netCDF::ncFloat, y_dim)},
             x_var{file.addVar("x", netCDF::ncFloat, x_dim)},
-            b_var{file.addVar("b", netCDF::ncFloat, {y_dim, x_dim})},
-            h_var{file.addVar("h", netCDF::ncFloat, {time_dim, y_dim, x_dim})},
-            hu_var{file.addVar("hu", netCDF::ncFloat, {time_dim, y_dim, x_dim})},
-            hv_var{file.addVar("hv", netCDF::ncFloat, {time_dim, y_dim, x_dim})},
+            b_var{file.addVar("b", netcdfType(), {y_dim, x_dim})},
+            h_var{file.addVar("h", netcdfType(), {time_dim, y_dim, x_dim})},
+            hu_var{file.addVar("hu", netcdfType(), {time_dim, y_dim, x_dim})},
+            hv_var{file.addVar("hv", netcdfType(), {time_dim, y_dim, x_dim})},
             time{&time},
-            h{&h.at(num_cells.at(0))},
-            hu{&hu.at(num_cells.at(0))},
-            hv{&hv.at(num_cells.at(0))},
+            h{h},
+            hu{hu},
+            hv{hv},
+            first_cell{num_cells.at(0)},
             timesteps_written{timesteps_written} {
       file.putAtt("Conventions", "CF-1.7");
       time_var.putAtt("units", "seconds since begin of simulation");
@@ -81,25 +131,22 @@ public:
       }
       x_var.putVar(x.data());
 
-      b_var.putVar(&b.at(num_cells.at(0)));
+      b_var.putVar(pack(b));
 
       time_var.putVar({0}, this->time);
 
       std::vector<size_t> start{0, 0, 0};
       std::vector<size_t> count{1, y_dim.getSize(), x_dim.getSize()};
-      h_var.putVar(start, count, this->h);
-      hu_var.putVar(start, count, this->hu);
-      hv_var.putVar(start, count, this->hv);
+      h_var.putVar(start, count, pack(this->h));
+      hu_var.putVar(start, count, pack(this->hu));
+      hv_var.putVar(start, count, pack(this->hv));
   }
 
   inline void write() {
       time_var.putVar({timesteps_written}, time);
-      h_var.putVar({timesteps_written, 0, 0},
-                   {1, y_dim.getSize(), x_dim.getSize()}, h);
-      hu_var.putVar({timesteps_written, 0, 0},
-                    {1, y_dim.getSize(), x_dim.getSize()}, hu);
-      hv_var.putVar({timesteps_written, 0, 0},
-                    {1, y_dim.getSize(), x_dim.getSize()}, hv);
+      h_var.putVar({timesteps_written, 0, 0}, {1, y_dim.getSize(), x_dim.getSize()}, pack(h));
+      hu_var.putVar({timesteps_written, 0, 0}, {1, y_dim.getSize(), x_dim.getSize()}, pack(hu));
+      hv_var.putVar({timesteps_written, 0, 0}, {1, y_dim.getSize(), x_dim.getSize()}, pack(hv));
   }
 
   /**